@@ -0,0 +1,62 @@
+#pragma once
+
+#include "matrix.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <limits>
+
+// Axis-aligned bounding box. A default constructed box is empty and extends to exactly
+// the first point or box added to it.
+struct AABB {
+    Vec3 min{std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max(), std::numeric_limits<Real>::max()};
+    Vec3 max{std::numeric_limits<Real>::lowest(), std::numeric_limits<Real>::lowest(), std::numeric_limits<Real>::lowest()};
+
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    Vec3 center() const {
+        return (min + max) / 2;
+    }
+
+    void extend(const Vec3& p) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    void extend(const AABB& box) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], box.min[i]);
+            max[i] = std::max(max[i], box.max[i]);
+        }
+    }
+
+    // Smallest box containing this one transformed by the affine transform m (Arvo's
+    // method: every output extent is a sum of the extremes of the products with m)
+    AABB transformed(const Matrix<4, 4>& m) const {
+        if (empty()) {
+            return {};
+        }
+        AABB ret;
+        for (int i = 0; i < 3; ++i) {
+            ret.min[i] = ret.max[i] = m[i][3];
+            for (int j = 0; j < 3; ++j) {
+                const Real a = m[i][j] * min[j];
+                const Real b = m[i][j] * max[j];
+                ret.min[i] += std::min(a, b);
+                ret.max[i] += std::max(a, b);
+            }
+        }
+        return ret;
+    }
+
+    // Whether the whole box lies on the negative side of the plane, i.e. where
+    // plane * (x, y, z, 1) < 0, tested at the corner furthest on the positive side
+    bool outside(const Vec4& plane) const {
+        const Vec3 p{plane.x >= 0 ? max.x : min.x, plane.y >= 0 ? max.y : min.y, plane.z >= 0 ? max.z : min.z};
+        return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w < 0;
+    }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Cache line size the blocks of texels, pixels and depths are laid out for
+constexpr std::size_t CacheLineSize = 64;
+
+// Allocator for containers whose storage must start on an Alignment boundary, e.g. so
+// that blocks of texels or pixels line up with cache lines
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {
+    }
+
+    T* allocate(const std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+    void deallocate(T* p, const std::size_t) {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+
+    friend bool operator==(const AlignedAllocator&, const AlignedAllocator&) {
+        return true;
+    }
+};
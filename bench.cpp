@@ -0,0 +1,411 @@
+// Throughput benchmarks of the stages of the renderer on the bundled assets, written as
+// JSON so results can be tracked across commits. Run from the directory holding obj/:
+//   tinyrenderer_bench [--warmup N] [--repetitions N] [--threads 1,2,4] [--output file]
+#include "deferred.h"
+#include "frame_arena.h"
+#include "frame_writer.h"
+#include "gl.h"
+#include "meshlet.h"
+#include "model.h"
+#include "post.h"
+#include "render_target.h"
+#include "shaders.h"
+#include "tgaimage.h"
+#include "vector.h"
+#include "zbuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Every heap allocation of the process goes through these, counted so the benchmarks
+// can report how many allocations a repetition makes
+namespace {
+std::atomic<std::uint64_t> heapAllocations{0};
+}
+
+void* operator new(const std::size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new(const std::size_t size, const std::align_val_t alignment) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t a = static_cast<std::size_t>(alignment);
+    if (void* p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::size_t, const std::align_val_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+const std::string MeshFile = "african_head/african_head.obj";
+// Meshes parsed by the loader benchmarks, every repetition loads all of them
+const std::string LoadFiles[] = {"african_head/african_head.obj", "african_head/african_head_eye_inner.obj", "boggie/body.obj",
+                                 "boggie/eyes.obj", "boggie/head.obj", "diablo3_pose/diablo3_pose.obj"};
+const std::string TextureFile = "obj/african_head/african_head_diffuse.tga";
+// Written by the frame benchmarks, like the renderer's frames into the working directory
+const std::string FrameFile = "bench_frame.tga";
+// Copies of the mesh's vertices transformed at once, so the vertex stage runs on a
+// buffer large enough to be split across threads
+constexpr int VertexCopies = 256;
+constexpr int Resolutions[] = {256, 512, 1024, 2048};
+constexpr std::uint32_t ColorSeed = 1;
+
+struct Options {
+    int warmup = 2;
+    int repetitions = 10;
+    std::vector<int> threads;
+    std::string output;
+};
+
+// Timings of one benchmark at one thread count. work is the amount processed per
+// repetition, in unit, so the rate of a repetition is work / seconds.
+struct Result {
+    std::string name;
+    std::string unit;
+    int threads = 1;
+    double work = 0;
+    std::vector<double> seconds;
+    double allocations = 0; // heap allocations per repetition
+};
+
+int maxThreads() {
+#ifdef _OPENMP
+    return omp_get_num_procs();
+#else
+    return 1;
+#endif
+}
+
+void setThreads(const int threads) {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#else
+    (void)threads;
+#endif
+}
+
+// Runs body warmup times untimed, then repetitions times into result, which gets the
+// duration of each run and the mean number of heap allocations. Every run is a frame:
+// the frame arenas are reset after it.
+void measure(const Options& options, const std::function<void()>& body, Result& result) {
+    // The loaders and the TGA codec report every file they read on stderr
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(nullptr);
+    for (int i = 0; i < options.warmup; ++i) {
+        body();
+        resetFrameArenas();
+    }
+    result.seconds.reserve(options.repetitions);
+    const std::uint64_t allocations = heapAllocations.load();
+    for (int i = 0; i < options.repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        resetFrameArenas();
+    }
+    result.allocations = static_cast<double>(heapAllocations.load() - allocations) / options.repetitions;
+    std::cerr.rdbuf(cerr_buffer);
+}
+
+void setupView(const int width, const int height) {
+    const Vec3 eye{-1, 0, 2};
+    const Vec3 center{0, 0, 0};
+    lookAt(eye, center, {0, 1, 0});
+    perspective(norm(eye - center));
+    viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
+}
+
+double fileMegabytes(const std::string& path) {
+    return std::filesystem::file_size(path) / 1e6;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results, const Options& options) {
+    out << "{\n  \"warmup\": " << options.warmup << ",\n  \"repetitions\": " << options.repetitions << ",\n";
+    out << "  \"simd_level\": " << static_cast<int>(simdLevel()) << ",\n  \"scalar_size\": " << sizeof(Real) << ",\n";
+    out << "  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::vector<double> sorted = r.seconds;
+        std::sort(sorted.begin(), sorted.end());
+        const double median = sorted[sorted.size() / 2];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"threads\": " << r.threads << ", \"unit\": \"" << r.unit
+            << "\", \"work\": " << r.work << ", \"median_rate\": " << r.work / median << ", \"best_rate\": " << r.work / sorted.front()
+            << ", \"allocations\": " << r.allocations << ", \"seconds\": [";
+        for (std::size_t k = 0; k < r.seconds.size(); ++k) {
+            out << (k ? ", " : "") << r.seconds[k];
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+bool parseOptions(const int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << "\n";
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--warmup") {
+            options.warmup = std::stoi(value);
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::max(1, std::stoi(value));
+        } else if (arg == "--threads") {
+            std::istringstream list(value);
+            for (std::string count; std::getline(list, count, ',');) {
+                options.threads.push_back(std::max(1, std::stoi(count)));
+            }
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            std::cerr << "unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    if (options.threads.empty()) {
+        for (int threads = 1; threads < maxThreads(); threads *= 2) {
+            options.threads.push_back(threads);
+        }
+        options.threads.push_back(maxThreads());
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    Model model;
+    if (!model.load(MeshFile)) {
+        return 1;
+    }
+    const std::filesystem::path temp = std::filesystem::temp_directory_path();
+    std::vector<std::string> mesh_paths;
+    double obj_megabytes = 0, mesh_megabytes = 0;
+    for (const std::string& file_name : LoadFiles) {
+        Model m;
+        mesh_paths.push_back(temp / ("tinyrenderer_bench" + std::to_string(mesh_paths.size()) + ".trmesh"));
+        if (!m.loadObj(file_name) || !m.saveMesh(mesh_paths.back())) {
+            return 1;
+        }
+        obj_megabytes += fileMegabytes("obj/" + file_name);
+        mesh_megabytes += fileMegabytes(mesh_paths.back());
+    }
+    TGAImage texture;
+    std::vector<std::uint8_t> tga_file;
+    if (!texture.read_tga_file(TextureFile) || !texture.encode_tga(tga_file)) {
+        return 1;
+    }
+    const std::vector<TGAColor> colors = randomColors(model.getVertexFaces().size(), ColorSeed);
+    const Meshlets meshlets(model);
+    std::vector<Vec3> vertices;
+    for (int i = 0; i < VertexCopies; ++i) {
+        vertices.insert(vertices.end(), model.getVertices().begin(), model.getVertices().end());
+    }
+
+    std::vector<Result> results;
+    // Whether a frame benchmark allocated in steady state, which fails the run
+    bool frames_allocate = false;
+    for (const int threads : options.threads) {
+        setThreads(threads);
+        const auto run = [&](const std::string& name, const std::string& unit, const double work, const std::function<void()>& body) {
+            measure(options, body, results.emplace_back(Result{name, unit, threads, work, {}, 0}));
+        };
+
+        run("load_obj", "MB", obj_megabytes, [&] {
+            for (const std::string& file_name : LoadFiles) {
+                Model m;
+                m.loadObj(file_name);
+            }
+        });
+        // Includes reading every page of the mapping, which is where the cost of a
+        // mapped file is paid
+        run("load_mesh", "MB", mesh_megabytes, [&] {
+            for (const std::string& path : mesh_paths) {
+                Model m;
+                m.loadMesh(path);
+                Real sum = 0;
+                for (const Vec3& v : m.getVertices()) {
+                    sum += v.x;
+                }
+                for (const Face& f : m.getVertexFaces()) {
+                    sum += f[0];
+                }
+                volatile Real sink = sum;
+                (void)sink;
+            }
+        });
+        // The load-time optimization pass on the mapped cache of the first mesh
+        run("optimize_mesh", "triangles", static_cast<double>(model.getVertexFaces().size()), [&] {
+            Model m;
+            m.loadMesh(mesh_paths.front());
+            m.optimize();
+        });
+        const std::size_t lod_targets[] = {model.getVertexFaces().size() / 2, model.getVertexFaces().size() / 4};
+        run("simplify", "triangles", static_cast<double>(model.getVertexFaces().size()), [&] {
+            std::vector<Real> errors;
+            model.simplified(lod_targets, errors);
+        });
+
+        setupView(800, 800);
+        ClipBuffer clip;
+        run("transform", "vertices", static_cast<double>(vertices.size()), [&] {
+            transformVertices(Perspective * Modelview, vertices, clip);
+        });
+
+        transformVertices(Perspective * Modelview, model.getVertices(), clip);
+        const auto faces = model.getVertexFaces();
+        // Clipping, setup and binning as draw() runs them, with nothing rasterized
+        run("triangle_setup", "triangles", static_cast<double>(faces.size()), [&] {
+            detail::binnedRasterize<detail::TrianglePlanes>(
+                faces.size(), 800, 800,
+                [&](const std::size_t i, std::pmr::vector<detail::TrianglePlanes>& tris) {
+                    detail::setupFace(clip, faces[i], 800, 800, tris, [](detail::TrianglePlanes&, const Vec3(&)[3]) {});
+                },
+                [](const detail::TrianglePlanes&, const detail::Rect&) {});
+        });
+
+        for (const int resolution : Resolutions) {
+            setupView(resolution, resolution);
+            transformVertices(Perspective * Modelview, model.getVertices(), clip);
+            const FlatShader shader{model, {1, 1, 1}, colors};
+            RenderTarget<BGR8> target(resolution, resolution);
+            draw(shader, clip, faces, target);
+            // Rates count the pixels the model covers, not the pixels of the framebuffer
+            double covered = 0;
+            for (int y = 0; y < resolution; ++y) {
+                for (int x = 0; x < resolution; ++x) {
+                    covered += target.depth().get(x, y) != ZBuffer::Far;
+                }
+            }
+            run("fill_" + std::to_string(resolution), "pixels", covered, [&] {
+                target.clear();
+                draw(shader, clip, faces, target);
+            });
+            // Same work as fill_N plus culling the meshlets and transforming the vertices of
+            // those left, whose faces are the only ones set up
+            std::vector<int> visible, meshlet_vertices, face_ids;
+            std::vector<Face> meshlet_faces;
+            ClipBuffer meshlet_clip;
+            run("fill_meshlets_" + std::to_string(resolution), "pixels", covered, [&] {
+                target.clear();
+                meshlets.cull(Perspective * Modelview, resolution, resolution, visible);
+                meshlets.gather(visible, meshlet_vertices, meshlet_faces, face_ids);
+                transformVertices(Perspective * Modelview, model.getVertices(), meshlet_vertices, meshlet_clip);
+                draw(FaceSubsetShader{shader, face_ids}, meshlet_clip, meshlet_faces, target);
+            });
+            // Same work as fill_N without the vertex and fragment stages
+            ZBuffer zbuffer(resolution, resolution);
+            run("depth_" + std::to_string(resolution), "pixels", covered, [&] {
+                zbuffer.clear();
+                drawDepth(clip, faces, zbuffer);
+            });
+            DeferredRenderer<BGR8> renderer(resolution, resolution);
+            run("fill_deferred_" + std::to_string(resolution), "pixels", covered, [&] {
+                renderer.clear();
+                renderer.draw(shader, clip, faces);
+                renderer.shade(target);
+            });
+            TGAImage framebuffer;
+            run("resolve_" + std::to_string(resolution), "pixels", static_cast<double>(resolution) * resolution, [&] {
+                target.resolve(framebuffer);
+            });
+            // Every effect, with the settings of the renderer's options
+            const PostProcess post(PostSettings{.ao_strength = 40, .exposure = 2, .gamma = Real{2.2}, .fxaa = true});
+            run("post_" + std::to_string(resolution), "pixels", static_cast<double>(resolution) * resolution, [&] {
+                post.apply(target, framebuffer);
+            });
+            // A whole frame as the renderer draws and writes it, waiting for the write, which
+            // in steady state allocates nothing
+            FrameWriter writer(resolution, resolution, TGAImage::RGB);
+            run("frame_" + std::to_string(resolution), "pixels", covered, [&] {
+                target.clear();
+                meshlets.cull(Perspective * Modelview, resolution, resolution, visible);
+                meshlets.gather(visible, meshlet_vertices, meshlet_faces, face_ids);
+                transformVertices(Perspective * Modelview, model.getVertices(), meshlet_vertices, meshlet_clip);
+                draw(FaceSubsetShader{shader, face_ids}, meshlet_clip, meshlet_faces, target);
+                TGAImage frame = writer.acquire();
+                post.apply(target, frame);
+                writer.submit(std::move(frame), FrameFile);
+                writer.finish();
+            });
+            if (results.back().allocations != 0) {
+                std::cerr << results.back().name << " allocated " << results.back().allocations << " times per frame\n";
+                frames_allocate = true;
+            }
+            // Same work as fill_N, so the rates show the cost of 4x multisampling
+            RenderTarget<BGR8, 4> msaa_target(resolution, resolution);
+            run("fill_msaa4_" + std::to_string(resolution), "pixels", covered, [&] {
+                msaa_target.clear();
+                draw(shader, clip, faces, msaa_target);
+            });
+            run("resolve_msaa4_" + std::to_string(resolution), "pixels", static_cast<double>(resolution) * resolution, [&] {
+                msaa_target.resolve(framebuffer);
+            });
+        }
+
+        // The codec is measured in memory, so the rates do not depend on the disk
+        const double texture_megabytes = static_cast<double>(texture.width()) * texture.height() * texture.bytespp() / 1e6;
+        std::vector<std::uint8_t> encoded;
+        run("tga_rle_encode", "MB", texture_megabytes, [&] {
+            texture.encode_tga(encoded);
+        });
+        run("tga_rle_decode", "MB", texture_megabytes, [&] {
+            TGAImage image;
+            image.decode_tga(tga_file);
+        });
+    }
+    for (const std::string& path : mesh_paths) {
+        std::filesystem::remove(path);
+    }
+    std::filesystem::remove(FrameFile);
+
+    if (options.output.empty()) {
+        writeJson(std::cout, results, options);
+        return frames_allocate ? 1 : 0;
+    }
+    std::ofstream out(options.output);
+    writeJson(out, results, options);
+    return out.good() && !frames_allocate ? 0 : 1;
+}
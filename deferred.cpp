@@ -0,0 +1,60 @@
+#include "deferred.h"
+
+#include <algorithm>
+#include <iterator>
+
+VisibilityBuffer::VisibilityBuffer(const int width, const int height)
+    : _width(width),
+      _height(height),
+      _blocks_x((width + BlockSize - 1) / BlockSize),
+      _ids(static_cast<std::size_t>(_blocks_x) * ((height + BlockSize - 1) / BlockSize)),
+      _depth(width, height) {
+    clear();
+}
+
+void VisibilityBuffer::clear() {
+    for (Block& block : _ids) {
+        std::fill(std::begin(block.ids), std::end(block.ids), Empty);
+    }
+    _depth.clear();
+}
+
+int VisibilityBuffer::width() const {
+    return _width;
+}
+
+int VisibilityBuffer::height() const {
+    return _height;
+}
+
+ZBuffer& VisibilityBuffer::depth() {
+    return _depth;
+}
+
+const ZBuffer& VisibilityBuffer::depth() const {
+    return _depth;
+}
+
+const std::uint32_t* VisibilityBuffer::blockIds(const int bx, const int by) const {
+    return _ids[static_cast<std::size_t>(by) * _blocks_x + bx].ids;
+}
+
+void rasterizeVisibility(const ClipBuffer& clip, std::span<const Face> faces, const std::uint32_t draw, VisibilityBuffer& visibility) {
+    struct Tri : detail::TrianglePlanes {
+        std::uint32_t id;
+    };
+    const int width = visibility.width();
+    const int height = visibility.height();
+    detail::binnedRasterize<Tri>(
+        faces.size(), width, height,
+        [&](const std::size_t i, std::pmr::vector<Tri>& tris) {
+            detail::setupFace(clip, faces[i], width, height, tris, [&](Tri& tri, const Vec3(&)[3]) {
+                tri.id = VisibilityBuffer::pack(draw, static_cast<std::uint32_t>(i));
+            });
+        },
+        [&](const Tri& tri, const detail::Rect& rect) {
+            detail::rasterizeTile(tri, rect, visibility.depth(), [&](const int x, const int y) {
+                visibility.set(x, y, tri.id);
+            });
+        });
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "frame_arena.h"
+#include "gl.h"
+#include "matrix.h"
+#include "model.h"
+#include "profile.h"
+#include "render_target.h"
+#include "vector.h"
+#include "zbuffer.h"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+// Depth and the id of the nearest triangle of every pixel. An id packs the index of
+// the draw the triangle belongs to in its upper DrawBits bits and the index of its face
+// in the lower FaceBits. Like the colours of a RenderTarget, ids are stored block by
+// block.
+class VisibilityBuffer {
+public:
+    static constexpr int BlockSize = ZBuffer::BlockSize;
+    static constexpr int FaceBits = 20;
+    static constexpr int DrawBits = 32 - FaceBits;
+    static constexpr std::uint32_t MaxFaces = std::uint32_t{1} << FaceBits;
+    // One less than DrawBits allow, so no id is Empty
+    static constexpr std::uint32_t MaxDraws = (std::uint32_t{1} << DrawBits) - 1;
+    static constexpr std::uint32_t Empty = ~std::uint32_t{0};
+
+    static std::uint32_t pack(const std::uint32_t draw, const std::uint32_t face) {
+        return draw << FaceBits | face;
+    }
+    static std::uint32_t drawOf(const std::uint32_t id) {
+        return id >> FaceBits;
+    }
+    static std::uint32_t faceOf(const std::uint32_t id) {
+        return id & (MaxFaces - 1);
+    }
+
+    VisibilityBuffer() = default;
+    VisibilityBuffer(const int width, const int height);
+
+    // Resets every id to Empty and every depth to ZBuffer::Far
+    void clear();
+    int width() const;
+    int height() const;
+    ZBuffer& depth();
+    const ZBuffer& depth() const;
+    // Ids of block (bx, by), row after row
+    const std::uint32_t* blockIds(const int bx, const int by) const;
+
+    // No bounds check: (x, y) must be inside the buffer
+    void set(const int x, const int y, const std::uint32_t id) {
+        _ids[static_cast<std::size_t>(y / BlockSize) * _blocks_x + x / BlockSize].ids[y % BlockSize * BlockSize + x % BlockSize] = id;
+    }
+
+private:
+    struct alignas(CacheLineSize) Block {
+        std::uint32_t ids[BlockSize * BlockSize];
+    };
+
+    int _width = 0;
+    int _height = 0;
+    int _blocks_x = 0;
+    std::vector<Block> _ids;
+    ZBuffer _depth;
+};
+
+// Writes the ids of the faces (indices into clip) of draw into visibility, wherever
+// they are nearest. It is the raster pass of draw() without any shading.
+void rasterizeVisibility(const ClipBuffer& clip, std::span<const Face> faces, const std::uint32_t draw, VisibilityBuffer& visibility);
+
+// Deferred rendering through a visibility buffer. draw() only rasterizes, keeping the
+// shader and the clip positions of the draw. shade() then runs the fragment stage once
+// for every covered pixel, in parallel over blocks of pixels, so pixels drawn over
+// several times are still shaded once. It reconstructs the perspective-correct weights
+// of a pixel from its id and the clip positions of the face. Pixels of one block and
+// face share the vertex stage and the setup of the face.
+template <typename Format>
+class DeferredRenderer {
+public:
+    DeferredRenderer(const int width, const int height)
+        : _visibility(width, height) {
+    }
+
+    ~DeferredRenderer() {
+        clear();
+    }
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    // Forgets the draws of the previous frame
+    void clear() {
+        _visibility.clear();
+        for (Draw* draw : _draws) {
+            draw->~Draw();
+        }
+        _draws.clear();
+        _arena.reset();
+    }
+
+    // Like draw(shader, clip, faces, target) of gl.h, with the shading deferred to
+    // shade(). The shader is copied and faces must outlive shade().
+    template <ShaderType Shader>
+    bool draw(const Shader& shader, const ClipBuffer& clip, std::span<const Face> faces) {
+        if (_draws.size() >= VisibilityBuffer::MaxDraws || faces.size() > VisibilityBuffer::MaxFaces) {
+            std::cerr << "too many draws or faces for the visibility buffer\n";
+            return false;
+        }
+        Draw* draw = std::pmr::polymorphic_allocator<>(&_arena).new_object<ShaderDraw<Shader>>(shader, clip, faces, &_arena);
+        rasterizeVisibility(draw->clip, faces, static_cast<std::uint32_t>(_draws.size()), _visibility);
+        _draws.push_back(draw);
+        return true;
+    }
+
+    // Depths of the pixels drawn since clear(), which shade() leaves out of the target
+    const ZBuffer& depth() const {
+        return _visibility.depth();
+    }
+
+    // Writes every pixel of target, shading covered ones and clearing the others
+    void shade(RenderTarget<Format>& target) const {
+        constexpr int B = VisibilityBuffer::BlockSize;
+        const int blocks_x = (target.width() + B - 1) / B;
+        const int num_blocks = blocks_x * ((target.height() + B - 1) / B);
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int block = 0; block < num_blocks; ++block) {
+            PROFILE_SCOPE("shade");
+            const int x0 = block % blocks_x * B;
+            const int y0 = block / blocks_x * B;
+            const std::uint32_t* ids = _visibility.blockIds(x0 / B, y0 / B);
+            std::uint64_t pending = 0;
+            for (int i = 0; i < B * B; ++i) {
+                const int x = x0 + i % B;
+                const int y = y0 + i / B;
+                if (x >= target.width() || y >= target.height()) {
+                    continue;
+                }
+                if (ids[i] == VisibilityBuffer::Empty) {
+                    target.set(x, y, {});
+                } else {
+                    pending |= std::uint64_t{1} << i;
+                }
+            }
+            // One call per draw present in the block
+            while (pending) {
+                const std::uint32_t draw = VisibilityBuffer::drawOf(ids[std::countr_zero(pending)]);
+                std::uint64_t pixels = 0;
+                for (std::uint64_t bits = pending; bits; bits &= bits - 1) {
+                    const int i = std::countr_zero(bits);
+                    if (VisibilityBuffer::drawOf(ids[i]) == draw) {
+                        pixels |= std::uint64_t{1} << i;
+                    }
+                }
+                _draws[draw]->shadeBlock(ids, pixels, x0, y0, target);
+                pending &= ~pixels;
+            }
+        }
+    }
+
+    const VisibilityBuffer& visibility() const {
+        return _visibility;
+    }
+
+private:
+    struct Draw {
+        Draw(const ClipBuffer& clip, std::pmr::memory_resource* resource)
+            : clip(clip, resource), viewport(Viewport) {
+        }
+        virtual ~Draw() = default;
+        // Shades the pixels of the block at (x0, y0) set in the mask, which all belong to this draw
+        virtual void shadeBlock(const std::uint32_t* ids, std::uint64_t pixels, const int x0, const int y0, RenderTarget<Format>& target) const = 0;
+
+        ClipBuffer clip;
+        Matrix<4, 4> viewport;
+    };
+
+    template <typename Shader>
+    struct ShaderDraw final : Draw {
+        ShaderDraw(const Shader& shader, const ClipBuffer& clip, std::span<const Face> faces, std::pmr::memory_resource* resource)
+            : Draw(clip, resource), shader(shader), faces(faces) {
+        }
+
+        void shadeBlock(const std::uint32_t* ids, std::uint64_t pixels, const int x0, const int y0, RenderTarget<Format>& target) const override {
+            constexpr int B = VisibilityBuffer::BlockSize;
+            detail::ShadedTriangle<typename Shader::Varyings> tri;
+            std::uint32_t face = VisibilityBuffer::Empty;
+            for (; pixels; pixels &= pixels - 1) {
+                const int i = std::countr_zero(pixels);
+                if (VisibilityBuffer::faceOf(ids[i]) != face) {
+                    face = VisibilityBuffer::faceOf(ids[i]);
+                    setup(face, tri);
+                }
+                const int x = x0 + i % B;
+                const int y = y0 + i / B;
+                target.set(x, y, detail::shadePixel(shader, tri, x, y));
+            }
+        }
+
+        // Planes whose values at a pixel are proportional to the perspective-correct
+        // weights of the corners there: with the corners' homogeneous screen positions
+        // h_i = (w x_i, w y_i, w), the point of the face seen at pixel p is a combination
+        // of the h_i with weights proportional to inverse([h_0 h_1 h_2]) * (p, 1). The
+        // weights are those of the whole face, whether it was clipped or not.
+        void setup(const std::uint32_t face, detail::ShadedTriangle<typename Shader::Varyings>& tri) const {
+            Matrix<3, 3> corners;
+            for (int c = 0; c < 3; ++c) {
+                const Vec4 h = this->viewport * this->clip[faces[face][c]];
+                corners[c] = {h.x, h.y, h.w};
+                tri.varyings[c] = shader.vertex(static_cast<int>(face), c);
+                tri.inv_w[c] = 1;
+            }
+            const Matrix<3, 3> planes = corners.invertTranspose();
+            for (int c = 0; c < 3; ++c) {
+                tri.dx[c] = planes[c].x;
+                tri.dy[c] = planes[c].y;
+                tri.c[c] = planes[c].z;
+            }
+        }
+
+        Shader shader;
+        std::span<const Face> faces;
+    };
+
+    VisibilityBuffer _visibility;
+    // The draws and their copies of the clip positions live until clear(), which
+    // destroys them and resets the arena they are allocated from
+    FrameArena _arena;
+    std::vector<Draw*> _draws;
+};
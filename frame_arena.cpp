@@ -0,0 +1,129 @@
+#include "frame_arena.h"
+
+#include "aligned_allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace {
+
+// Size of the first block of an arena created empty
+constexpr std::size_t MinBlockSize = 64 << 10;
+
+std::byte* allocateBlock(const std::size_t size) {
+    return static_cast<std::byte*>(::operator new(size, std::align_val_t{CacheLineSize}));
+}
+
+void freeBlock(std::byte* block) {
+    ::operator delete(block, std::align_val_t{CacheLineSize});
+}
+
+// The arenas of the live threads, for resetFrameArenas()
+std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<FrameArena*>& registry() {
+    static std::vector<FrameArena*> arenas;
+    return arenas;
+}
+
+struct RegisteredArena {
+    RegisteredArena() {
+        std::lock_guard lock(registryMutex());
+        registry().push_back(&arena);
+    }
+    ~RegisteredArena() {
+        std::lock_guard lock(registryMutex());
+        std::erase(registry(), &arena);
+    }
+
+    FrameArena arena;
+};
+
+}
+
+FrameArena::FrameArena(const std::size_t capacity) {
+    if (capacity > 0) {
+        _block = allocateBlock(capacity);
+        _blockSize = capacity;
+    }
+}
+
+FrameArena::~FrameArena() {
+    for (const auto& [block, size] : _retired) {
+        freeBlock(block);
+    }
+    if (_block) {
+        freeBlock(_block);
+    }
+}
+
+void FrameArena::reset() {
+    if (!_retired.empty()) {
+        const std::size_t capacity = this->capacity();
+        for (const auto& [block, size] : _retired) {
+            freeBlock(block);
+        }
+        _retired.clear();
+        _retiredBytes = 0;
+        freeBlock(_block);
+        _block = allocateBlock(capacity);
+        _blockSize = capacity;
+    }
+    _offset = 0;
+}
+
+std::size_t FrameArena::used() const {
+    return _retiredBytes + _offset;
+}
+
+std::size_t FrameArena::capacity() const {
+    std::size_t capacity = _blockSize;
+    for (const auto& [block, size] : _retired) {
+        capacity += size;
+    }
+    return capacity;
+}
+
+void* FrameArena::do_allocate(const std::size_t bytes, const std::size_t alignment) {
+    const auto aligned = [&](const std::size_t offset) {
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(_block) + offset;
+        return offset + ((alignment - address % alignment) % alignment);
+    };
+    std::size_t offset = aligned(_offset);
+    if (!_block || offset + bytes > _blockSize) {
+        if (_block) {
+            _retired.emplace_back(_block, _blockSize);
+            _retiredBytes += _offset;
+        }
+        _blockSize = std::max({2 * _blockSize, bytes + alignment, MinBlockSize});
+        _block = allocateBlock(_blockSize);
+        _offset = 0;
+        offset = aligned(0);
+    }
+    _offset = offset + bytes;
+    return _block + offset;
+}
+
+void FrameArena::do_deallocate(void*, const std::size_t, const std::size_t) {
+}
+
+bool FrameArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+FrameArena& frameArena() {
+    thread_local RegisteredArena registered;
+    return registered.arena;
+}
+
+void resetFrameArenas() {
+    std::lock_guard lock(registryMutex());
+    for (FrameArena* arena : registry()) {
+        arena->reset();
+    }
+}
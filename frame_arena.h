@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+// Memory resource for data that lives at most until the end of a frame. Allocating bumps
+// an offset into a block, deallocating does nothing and reset() frees everything at once.
+// A block that runs out is retired for a new one twice as large, and the next reset()
+// replaces all of them by one block as large as they were together, so once a frame has
+// been through, the frames like it take nothing from the heap. Not thread-safe: every
+// thread allocates from its own arena, see frameArena().
+class FrameArena : public std::pmr::memory_resource {
+public:
+    explicit FrameArena(const std::size_t capacity = 0);
+    ~FrameArena() override;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Frees everything allocated since the last reset
+    void reset();
+    // Bytes allocated since the last reset, with their alignment padding
+    std::size_t used() const;
+    // Bytes of all the blocks held
+    std::size_t capacity() const;
+
+private:
+    void* do_allocate(const std::size_t bytes, const std::size_t alignment) override;
+    void do_deallocate(void* p, const std::size_t bytes, const std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::byte* _block = nullptr;
+    std::size_t _blockSize = 0;
+    std::size_t _offset = 0;
+    std::vector<std::pair<std::byte*, std::size_t>> _retired; // full blocks and their sizes
+    std::size_t _retiredBytes = 0;                              // used in the retired blocks
+};
+
+// The frame arena of the calling thread, for data which does not outlive the frame: the
+// pipeline's per-draw lists and per-thread scratch buffers
+FrameArena& frameArena();
+// Resets the frame arenas of all threads, once a frame is done with everything allocated
+// from them. No other thread may be allocating from its arena meanwhile.
+void resetFrameArenas();
@@ -0,0 +1,107 @@
+#include "frame_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef TINYRENDERER_WRITEV
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+FrameStream::FrameStream(const std::string& path) {
+#ifdef TINYRENDERER_WRITEV
+    if (path == "-") {
+        _fd = STDOUT_FILENO;
+    } else {
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        _owned = true;
+    }
+    _open = _fd >= 0;
+#else
+    if (path == "-") {
+        _file = stdout;
+    } else {
+        _file = std::fopen(path.c_str(), "wb");
+        _owned = true;
+    }
+    _open = _file != nullptr;
+#endif
+    if (!_open) {
+        std::cerr << "can't open file " << path << "\n";
+    }
+}
+
+FrameStream::~FrameStream() {
+#ifdef TINYRENDERER_WRITEV
+    if (_open && _owned) {
+        ::close(_fd);
+    }
+#else
+    if (_open && _owned) {
+        std::fclose(_file);
+    }
+#endif
+}
+
+bool FrameStream::isOpen() const {
+    return _open;
+}
+
+bool FrameStream::write(const TGAImage& frame, const bool vflip) {
+    if (!_open || frame.is_flipped()) {
+        std::cerr << "can't stream the frame\n";
+        return false;
+    }
+    const int height = frame.height();
+    const std::size_t row_bytes = static_cast<std::size_t>(frame.width()) * frame.bytespp();
+    // Stored row of the y-th row from the top
+    const auto row = [&](const int y) {
+        return frame.buffer() + static_cast<std::size_t>(vflip ? height - 1 - y : y) * row_bytes;
+    };
+#ifdef TINYRENDERER_WRITEV
+    _rows.resize(height);
+    for (int y = 0; y < height; ++y) {
+        _rows[y] = {const_cast<std::uint8_t*>(row(y)), row_bytes};
+    }
+    // A pipe may take fewer bytes than asked, and at most IOV_MAX rows go per call
+    iovec* next = _rows.data();
+    iovec* const end = next + _rows.size();
+    while (next < end) {
+        const ssize_t written = ::writev(_fd, next, static_cast<int>(std::min<std::ptrdiff_t>(end - next, IOV_MAX)));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "can't stream the frame: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        for (std::size_t left = static_cast<std::size_t>(written); left > 0;) {
+            const std::size_t n = std::min(left, next->iov_len);
+            next->iov_base = static_cast<std::uint8_t*>(next->iov_base) + n;
+            next->iov_len -= n;
+            left -= n;
+            if (next->iov_len == 0) {
+                ++next;
+            }
+        }
+    }
+    return true;
+#else
+    for (int y = 0; y < height; ++y) {
+        if (std::fwrite(row(y), 1, row_bytes, _file) != row_bytes) {
+            std::cerr << "can't stream the frame\n";
+            return false;
+        }
+    }
+    return std::fflush(_file) == 0;
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "tgaimage.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYRENDERER_WRITEV
+#include <sys/uio.h>
+#endif
+
+// Writes frames as raw pixels, with no header, padding or compression, to stdout or to
+// a file such as a named pipe, so an encoder can read them as they are rendered, e.g.
+//   tinyrenderer flat float poses.txt - - | ffmpeg -f rawvideo -pix_fmt bgr24 -s 800x800 -i - out.mp4
+// Pixels keep the byte order of TGAImage: bgr24 for RGB frames, bgra for RGBA frames
+// and gray for GRAYSCALE frames. Writing to a pipe whose reader has gone raises SIGPIPE,
+// which ends the process unless it is ignored, as main does when streaming.
+class FrameStream {
+public:
+    FrameStream() = default;
+    // "-" is stdout. Opening a named pipe blocks until a reader opens it.
+    explicit FrameStream(const std::string& path);
+    ~FrameStream();
+
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    bool isOpen() const;
+    // Writes the rows of frame top row first. With vflip, as for TGAImage::write_tga_file,
+    // row 0 of the image is the bottom one. The rows are gathered straight from the image
+    // by the write, in whatever order, without copying them.
+    bool write(const TGAImage& frame, const bool vflip = true);
+
+private:
+    bool _open = false;
+#ifdef TINYRENDERER_WRITEV
+    int _fd = -1;
+    std::vector<iovec> _rows; // of the last frame, kept for the next one
+#else
+    std::FILE* _file = nullptr;
+#endif
+    bool _owned = false;
+};
@@ -0,0 +1,74 @@
+#include "frame_writer.h"
+
+#include "profile.h"
+
+FrameWriter::FrameWriter(const int width, const int height, const int bpp, const std::size_t max_in_flight)
+    : _width(width), _height(height), _bpp(bpp), _maxInFlight(max_in_flight), _thread(&FrameWriter::run, this) {
+}
+
+FrameWriter::FrameWriter(FrameStream& stream, const int width, const int height, const int bpp, const std::size_t max_in_flight)
+    : _stream(&stream), _width(width), _height(height), _bpp(bpp), _maxInFlight(max_in_flight), _thread(&FrameWriter::run, this) {
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard lock(_mutex);
+        _stop = true;
+    }
+    _queued.notify_one();
+    _thread.join();
+}
+
+TGAImage FrameWriter::acquire() {
+    std::unique_lock lock(_mutex);
+    if (_free.empty() && _allocated < _maxInFlight) {
+        ++_allocated;
+        lock.unlock();
+        return TGAImage(_width, _height, _bpp);
+    }
+    _written.wait(lock, [this] { return !_free.empty(); });
+    TGAImage frame = std::move(_free.back());
+    _free.pop_back();
+    return frame;
+}
+
+void FrameWriter::submit(TGAImage&& frame, std::string file_name) {
+    {
+        std::lock_guard lock(_mutex);
+        _queue.emplace_back(std::move(frame), std::move(file_name));
+    }
+    _queued.notify_one();
+}
+
+bool FrameWriter::finish() {
+    std::unique_lock lock(_mutex);
+    _written.wait(lock, [this] { return _queue.empty() && _writing == 0; });
+    return !_failed;
+}
+
+void FrameWriter::run() {
+    if constexpr (profile::Enabled) {
+        profile::setThreadName("frame writer");
+    }
+    std::unique_lock lock(_mutex);
+    while (true) {
+        _queued.wait(lock, [this] { return _stop || !_queue.empty(); });
+        if (_queue.empty()) {
+            return;
+        }
+        auto [frame, file_name] = std::move(_queue.front());
+        _queue.pop_front();
+        ++_writing;
+        lock.unlock();
+        bool ok;
+        {
+            PROFILE_SCOPE("write");
+            ok = _stream ? _stream->write(frame) : frame.write_tga_file(file_name, _encoded);
+        }
+        lock.lock();
+        --_writing;
+        _failed = _failed || !ok;
+        _free.push_back(std::move(frame));
+        _written.notify_all();
+    }
+}
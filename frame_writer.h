@@ -0,0 +1,61 @@
+#pragma once
+
+#include "frame_stream.h"
+#include "tgaimage.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Writes frames to TGA files, or to a FrameStream, on a background thread, so that
+// encoding and I/O overlap with rendering the next frame. Frames are recycled: acquire() returns an
+// image that has already been written, still holding its pixels, or a new one while
+// fewer than max_in_flight exist, and blocks while all of them are still waiting to be
+// written. Every frame is encoded into the same buffer, so once the first few are
+// written the writer allocates nothing.
+class FrameWriter {
+public:
+    FrameWriter(const int width, const int height, const int bpp, const std::size_t max_in_flight = 2);
+    // Writes the frames to stream, in submission order, instead of to their files
+    FrameWriter(FrameStream& stream, const int width, const int height, const int bpp, const std::size_t max_in_flight = 2);
+    // Writes the frames still queued
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    TGAImage acquire();
+    void submit(TGAImage&& frame, std::string file_name);
+    // Waits until every submitted frame is written and returns whether all writes succeeded
+    bool finish();
+
+private:
+    void run();
+
+    FrameStream* _stream = nullptr;
+    int _width;
+    int _height;
+    int _bpp;
+    std::size_t _maxInFlight;
+    std::size_t _allocated = 0;
+    std::size_t _writing = 0;
+    bool _stop = false;
+    bool _failed = false;
+    // The queue takes its blocks from a pool, which keeps those it is given back, so a
+    // steady stream of frames allocates nothing (both are guarded by _mutex)
+    std::pmr::unsynchronized_pool_resource _queuePool;
+    std::pmr::deque<std::pair<TGAImage, std::string>> _queue{&_queuePool};
+    std::vector<TGAImage> _free;
+    std::mutex _mutex;
+    std::condition_variable _queued;
+    std::condition_variable _written;
+    std::vector<std::uint8_t> _encoded; // TGA file being written, only used by the thread
+    std::thread _thread;
+};
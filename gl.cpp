@@ -1,10 +1,605 @@
 #include "gl.h"
 
 #include "matrix.h"
+#include "profile.h"
 
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
 
-void perspective(const double focal) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Meshes with fewer vertices than this are transformed on one thread
+constexpr std::size_t ParallelVertexThreshold = 1 << 14;
+
+// Triangles are clipped to w >= NearW. perspective() makes w the distance to the eye
+// divided by the focal length, so this keeps geometry closer than 1/128 of it.
+constexpr Real NearW = Real{1} / 128;
+// Pixels the guard band extends beyond every edge of the framebuffer. Triangles within
+// it are rasterized without clipping, as their bounding box is clamped to the
+// framebuffer anyway, and it keeps every screen position small enough for setup.
+constexpr Real GuardBand = 4096;
+
+// Fractional bits of the screen coordinates in CoverageMode::FixedPoint
+constexpr int SubpixelBits = 8;
+constexpr Real SubpixelScale = 1 << SubpixelBits;
+static_assert(SubpixelBits >= 4, "the 1/16 pixel sample offsets must be exact in fixed point");
+// Largest screen coordinate, in pixels, for which the fixed-point edge functions fit in
+// 64 bits: products of two snapped coordinate differences need 2 * (21 + 9 + 1) bits
+constexpr Real MaxFixedCoordinate = 1 << 21;
+
+// A span kernel depth-tests pixels [x0, x1] of row y, see detail::depthTestSpan. Every
+// pixel evaluates the planes as dx * x + row with an exact integer x, so all kernels
+// produce bit-identical results regardless of how many pixels they process per step.
+using SpanKernel = std::uint64_t (*)(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan);
+
+std::uint64_t depthTestSpanScalar(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    Real row[4];
+    for (int i = 0; i < 4; ++i) {
+        row[i] = tri.dy[i] * y + tri.c[i];
+    }
+    std::uint64_t mask = 0;
+    for (int x = x0; x <= x1; ++x) {
+        const Real w0 = tri.dx[0] * x + row[0];
+        const Real w1 = tri.dx[1] * x + row[1];
+        const Real w2 = tri.dx[2] * x + row[2];
+        if (w0 < 0 || w1 < 0 || w2 < 0)
+            continue;
+        PROFILE_COUNT(PixelsTested, 1);
+
+        const Real z = tri.dx[3] * x + row[3];
+        if (z <= zspan[x - x0])
+            continue;
+
+        zspan[x - x0] = z;
+        mask |= std::uint64_t{1} << (x - x0);
+    }
+    return mask;
+}
+
+// Same as depthTestSpanScalar, with the coverage decided by the fixed-point edges
+std::uint64_t depthTestSpanFixedScalar(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    std::int64_t row[3];
+    for (int i = 0; i < 3; ++i) {
+        row[i] = tri.edge_dy[i] * y + tri.edge_c[i];
+    }
+    const Real zrow_c = tri.dy[3] * y + tri.c[3];
+    std::uint64_t mask = 0;
+    for (int x = x0; x <= x1; ++x) {
+        if (tri.edge_dx[0] * x + row[0] < 0 || tri.edge_dx[1] * x + row[1] < 0 || tri.edge_dx[2] * x + row[2] < 0)
+            continue;
+        PROFILE_COUNT(PixelsTested, 1);
+
+        const Real z = tri.dx[3] * x + zrow_c;
+        if (z <= zspan[x - x0])
+            continue;
+
+        zspan[x - x0] = z;
+        mask |= std::uint64_t{1} << (x - x0);
+    }
+    return mask;
+}
+
+// Same as depthTestSpanScalar for a span the triangle is known to cover entirely, so
+// only the depth is tested. The fill kernels serve the depth-only pass of drawDepth().
+std::uint64_t depthFillSpanScalar(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    PROFILE_COUNT(PixelsTested, x1 - x0 + 1);
+    const Real row = tri.dy[3] * y + tri.c[3];
+    std::uint64_t mask = 0;
+    for (int x = x0; x <= x1; ++x) {
+        const Real z = tri.dx[3] * x + row;
+        if (z > zspan[x - x0]) {
+            zspan[x - x0] = z;
+            mask |= std::uint64_t{1} << (x - x0);
+        }
+    }
+    return mask;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TINYRENDERER_X86_SIMD
+
+#ifdef TINYRENDERER_FLOAT
+__attribute__((target("sse2"))) std::uint64_t depthTestSpanSSE2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    __m128 dx[4], row[4];
+    for (int i = 0; i < 4; ++i) {
+        dx[i] = _mm_set1_ps(tri.dx[i]);
+        row[i] = _mm_set1_ps(tri.dy[i] * y + tri.c[i]);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 step = _mm_set1_ps(4.0f);
+    __m128 xs = _mm_setr_ps(x0, x0 + 1, x0 + 2, x0 + 3);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 3 <= x1; x += 4, xs = _mm_add_ps(xs, step)) {
+        const __m128 w0 = _mm_add_ps(_mm_mul_ps(dx[0], xs), row[0]);
+        const __m128 w1 = _mm_add_ps(_mm_mul_ps(dx[1], xs), row[1]);
+        const __m128 w2 = _mm_add_ps(_mm_mul_ps(dx[2], xs), row[2]);
+        const __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+        if (!_mm_movemask_ps(inside))
+            continue;
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm_movemask_ps(inside))));
+
+        const __m128 z = _mm_add_ps(_mm_mul_ps(dx[3], xs), row[3]);
+        const __m128 depth = _mm_loadu_ps(zspan + (x - x0));
+        const __m128 pass = _mm_and_ps(inside, _mm_cmpgt_ps(z, depth));
+        const int bits = _mm_movemask_ps(pass);
+        if (!bits)
+            continue;
+
+        _mm_storeu_ps(zspan + (x - x0), _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, depth)));
+        mask |= static_cast<std::uint64_t>(bits) << (x - x0);
+    }
+    if (x <= x1) {
+        mask |= depthTestSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) std::uint64_t depthTestSpanAVX2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    __m256 dx[4], row[4];
+    for (int i = 0; i < 4; ++i) {
+        dx[i] = _mm256_set1_ps(tri.dx[i]);
+        row[i] = _mm256_set1_ps(tri.dy[i] * y + tri.c[i]);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 step = _mm256_set1_ps(8.0f);
+    __m256 xs = _mm256_setr_ps(x0, x0 + 1, x0 + 2, x0 + 3, x0 + 4, x0 + 5, x0 + 6, x0 + 7);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 7 <= x1; x += 8, xs = _mm256_add_ps(xs, step)) {
+        const __m256 w0 = _mm256_add_ps(_mm256_mul_ps(dx[0], xs), row[0]);
+        const __m256 w1 = _mm256_add_ps(_mm256_mul_ps(dx[1], xs), row[1]);
+        const __m256 w2 = _mm256_add_ps(_mm256_mul_ps(dx[2], xs), row[2]);
+        const __m256 inside = _mm256_and_ps(_mm256_cmp_ps(w0, zero, _CMP_GE_OQ),
+                                            _mm256_and_ps(_mm256_cmp_ps(w1, zero, _CMP_GE_OQ), _mm256_cmp_ps(w2, zero, _CMP_GE_OQ)));
+        if (!_mm256_movemask_ps(inside))
+            continue;
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm256_movemask_ps(inside))));
+
+        const __m256 z = _mm256_add_ps(_mm256_mul_ps(dx[3], xs), row[3]);
+        const __m256 depth = _mm256_loadu_ps(zspan + (x - x0));
+        const __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(z, depth, _CMP_GT_OQ));
+        const int bits = _mm256_movemask_ps(pass);
+        if (!bits)
+            continue;
+
+        _mm256_storeu_ps(zspan + (x - x0), _mm256_blendv_ps(depth, z, pass));
+        mask |= static_cast<std::uint64_t>(bits) << (x - x0);
+    }
+    if (x <= x1) {
+        mask |= depthTestSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+// max(z, depth) is z exactly where z > depth, so the fill kernels store without a blend
+__attribute__((target("sse2"))) std::uint64_t depthFillSpanSSE2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    const __m128 dz = _mm_set1_ps(tri.dx[3]);
+    const __m128 row = _mm_set1_ps(tri.dy[3] * y + tri.c[3]);
+    const __m128 step = _mm_set1_ps(4.0f);
+    __m128 xs = _mm_setr_ps(x0, x0 + 1, x0 + 2, x0 + 3);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 3 <= x1; x += 4, xs = _mm_add_ps(xs, step)) {
+        const __m128 z = _mm_add_ps(_mm_mul_ps(dz, xs), row);
+        const __m128 depth = _mm_loadu_ps(zspan + (x - x0));
+        _mm_storeu_ps(zspan + (x - x0), _mm_max_ps(z, depth));
+        mask |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_cmpgt_ps(z, depth))) << (x - x0);
+    }
+    PROFILE_COUNT(PixelsTested, x - x0);
+    if (x <= x1) {
+        mask |= depthFillSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) std::uint64_t depthFillSpanAVX2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    const __m256 dz = _mm256_set1_ps(tri.dx[3]);
+    const __m256 row = _mm256_set1_ps(tri.dy[3] * y + tri.c[3]);
+    const __m256 step = _mm256_set1_ps(8.0f);
+    __m256 xs = _mm256_setr_ps(x0, x0 + 1, x0 + 2, x0 + 3, x0 + 4, x0 + 5, x0 + 6, x0 + 7);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 7 <= x1; x += 8, xs = _mm256_add_ps(xs, step)) {
+        const __m256 z = _mm256_add_ps(_mm256_mul_ps(dz, xs), row);
+        const __m256 depth = _mm256_loadu_ps(zspan + (x - x0));
+        _mm256_storeu_ps(zspan + (x - x0), _mm256_max_ps(z, depth));
+        mask |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(z, depth, _CMP_GT_OQ))) << (x - x0);
+    }
+    PROFILE_COUNT(PixelsTested, x - x0);
+    if (x <= x1) {
+        mask |= depthFillSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+#else
+__attribute__((target("sse2"))) std::uint64_t depthTestSpanSSE2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    __m128d dx[4], row[4];
+    for (int i = 0; i < 4; ++i) {
+        dx[i] = _mm_set1_pd(tri.dx[i]);
+        row[i] = _mm_set1_pd(tri.dy[i] * y + tri.c[i]);
+    }
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d step = _mm_set1_pd(2.0);
+    __m128d xs = _mm_setr_pd(x0, x0 + 1);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 1 <= x1; x += 2, xs = _mm_add_pd(xs, step)) {
+        const __m128d w0 = _mm_add_pd(_mm_mul_pd(dx[0], xs), row[0]);
+        const __m128d w1 = _mm_add_pd(_mm_mul_pd(dx[1], xs), row[1]);
+        const __m128d w2 = _mm_add_pd(_mm_mul_pd(dx[2], xs), row[2]);
+        const __m128d inside = _mm_and_pd(_mm_cmpge_pd(w0, zero), _mm_and_pd(_mm_cmpge_pd(w1, zero), _mm_cmpge_pd(w2, zero)));
+        if (!_mm_movemask_pd(inside))
+            continue;
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm_movemask_pd(inside))));
+
+        const __m128d z = _mm_add_pd(_mm_mul_pd(dx[3], xs), row[3]);
+        const __m128d depth = _mm_loadu_pd(zspan + (x - x0));
+        const __m128d pass = _mm_and_pd(inside, _mm_cmpgt_pd(z, depth));
+        const int bits = _mm_movemask_pd(pass);
+        if (!bits)
+            continue;
+
+        _mm_storeu_pd(zspan + (x - x0), _mm_or_pd(_mm_and_pd(pass, z), _mm_andnot_pd(pass, depth)));
+        mask |= static_cast<std::uint64_t>(bits) << (x - x0);
+    }
+    if (x <= x1) {
+        mask |= depthTestSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) std::uint64_t depthTestSpanAVX2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    __m256d dx[4], row[4];
+    for (int i = 0; i < 4; ++i) {
+        dx[i] = _mm256_set1_pd(tri.dx[i]);
+        row[i] = _mm256_set1_pd(tri.dy[i] * y + tri.c[i]);
+    }
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d step = _mm256_set1_pd(4.0);
+    __m256d xs = _mm256_setr_pd(x0, x0 + 1, x0 + 2, x0 + 3);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 3 <= x1; x += 4, xs = _mm256_add_pd(xs, step)) {
+        const __m256d w0 = _mm256_add_pd(_mm256_mul_pd(dx[0], xs), row[0]);
+        const __m256d w1 = _mm256_add_pd(_mm256_mul_pd(dx[1], xs), row[1]);
+        const __m256d w2 = _mm256_add_pd(_mm256_mul_pd(dx[2], xs), row[2]);
+        const __m256d inside = _mm256_and_pd(_mm256_cmp_pd(w0, zero, _CMP_GE_OQ),
+                                             _mm256_and_pd(_mm256_cmp_pd(w1, zero, _CMP_GE_OQ), _mm256_cmp_pd(w2, zero, _CMP_GE_OQ)));
+        if (!_mm256_movemask_pd(inside))
+            continue;
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm256_movemask_pd(inside))));
+
+        const __m256d z = _mm256_add_pd(_mm256_mul_pd(dx[3], xs), row[3]);
+        const __m256d depth = _mm256_loadu_pd(zspan + (x - x0));
+        const __m256d pass = _mm256_and_pd(inside, _mm256_cmp_pd(z, depth, _CMP_GT_OQ));
+        const int bits = _mm256_movemask_pd(pass);
+        if (!bits)
+            continue;
+
+        _mm256_storeu_pd(zspan + (x - x0), _mm256_blendv_pd(depth, z, pass));
+        mask |= static_cast<std::uint64_t>(bits) << (x - x0);
+    }
+    if (x <= x1) {
+        mask |= depthTestSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+// max(z, depth) is z exactly where z > depth, so the fill kernels store without a blend
+__attribute__((target("sse2"))) std::uint64_t depthFillSpanSSE2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    const __m128d dz = _mm_set1_pd(tri.dx[3]);
+    const __m128d row = _mm_set1_pd(tri.dy[3] * y + tri.c[3]);
+    const __m128d step = _mm_set1_pd(2.0);
+    __m128d xs = _mm_setr_pd(x0, x0 + 1);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 1 <= x1; x += 2, xs = _mm_add_pd(xs, step)) {
+        const __m128d z = _mm_add_pd(_mm_mul_pd(dz, xs), row);
+        const __m128d depth = _mm_loadu_pd(zspan + (x - x0));
+        _mm_storeu_pd(zspan + (x - x0), _mm_max_pd(z, depth));
+        mask |= static_cast<std::uint64_t>(_mm_movemask_pd(_mm_cmpgt_pd(z, depth))) << (x - x0);
+    }
+    PROFILE_COUNT(PixelsTested, x - x0);
+    if (x <= x1) {
+        mask |= depthFillSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) std::uint64_t depthFillSpanAVX2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    const __m256d dz = _mm256_set1_pd(tri.dx[3]);
+    const __m256d row = _mm256_set1_pd(tri.dy[3] * y + tri.c[3]);
+    const __m256d step = _mm256_set1_pd(4.0);
+    __m256d xs = _mm256_setr_pd(x0, x0 + 1, x0 + 2, x0 + 3);
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 3 <= x1; x += 4, xs = _mm256_add_pd(xs, step)) {
+        const __m256d z = _mm256_add_pd(_mm256_mul_pd(dz, xs), row);
+        const __m256d depth = _mm256_loadu_pd(zspan + (x - x0));
+        _mm256_storeu_pd(zspan + (x - x0), _mm256_max_pd(z, depth));
+        mask |= static_cast<std::uint64_t>(_mm256_movemask_pd(_mm256_cmp_pd(z, depth, _CMP_GT_OQ))) << (x - x0);
+    }
+    PROFILE_COUNT(PixelsTested, x - x0);
+    if (x <= x1) {
+        mask |= depthFillSpanScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+#endif
+
+// AVX2 has no 64-bit multiply, so the edges are stepped by exact integer additions
+// instead, which still matches depthTestSpanFixedScalar bit for bit
+__attribute__((target("avx2"))) std::uint64_t depthTestSpanFixedAVX2(const detail::TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    __m256i edge[3], step[3];
+    for (int i = 0; i < 3; ++i) {
+        const std::int64_t dx = tri.edge_dx[i];
+        const std::int64_t e = tri.edge_dx[i] * x0 + tri.edge_dy[i] * y + tri.edge_c[i];
+        edge[i] = _mm256_setr_epi64x(e, e + dx, e + 2 * dx, e + 3 * dx);
+        step[i] = _mm256_set1_epi64x(4 * dx);
+    }
+    const __m256i zero = _mm256_setzero_si256();
+#ifdef TINYRENDERER_FLOAT
+    const __m128 dz = _mm_set1_ps(tri.dx[3]);
+    const __m128 zrow_c = _mm_set1_ps(tri.dy[3] * y + tri.c[3]);
+    const __m128 xstep = _mm_set1_ps(4.0f);
+    __m128 xs = _mm_setr_ps(x0, x0 + 1, x0 + 2, x0 + 3);
+    // Gathers the low half of every 64-bit lane, to narrow the masks to 32-bit lanes
+    const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+#else
+    const __m256d dz = _mm256_set1_pd(tri.dx[3]);
+    const __m256d zrow_c = _mm256_set1_pd(tri.dy[3] * y + tri.c[3]);
+    const __m256d xstep = _mm256_set1_pd(4.0);
+    __m256d xs = _mm256_setr_pd(x0, x0 + 1, x0 + 2, x0 + 3);
+#endif
+    std::uint64_t mask = 0;
+    int x = x0;
+    for (; x + 3 <= x1; x += 4) {
+        const __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(zero, edge[0]),
+                                                _mm256_or_si256(_mm256_cmpgt_epi64(zero, edge[1]), _mm256_cmpgt_epi64(zero, edge[2])));
+        const bool any_inside = _mm256_movemask_epi8(outside) != -1;
+#ifdef TINYRENDERER_FLOAT
+        const __m128 inside = _mm_andnot_ps(_mm_castsi128_ps(_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(outside, narrow))),
+                                            _mm_castsi128_ps(_mm_set1_epi32(-1)));
+        const __m128 z = _mm_add_ps(_mm_mul_ps(dz, xs), zrow_c);
+        xs = _mm_add_ps(xs, xstep);
+#else
+        const __m256d inside = _mm256_andnot_pd(_mm256_castsi256_pd(outside), _mm256_castsi256_pd(_mm256_set1_epi64x(-1)));
+        const __m256d z = _mm256_add_pd(_mm256_mul_pd(dz, xs), zrow_c);
+        xs = _mm256_add_pd(xs, xstep);
+#endif
+        for (int i = 0; i < 3; ++i) {
+            edge[i] = _mm256_add_epi64(edge[i], step[i]);
+        }
+        if (!any_inside)
+            continue;
+#ifdef TINYRENDERER_FLOAT
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm_movemask_ps(inside))));
+#else
+        PROFILE_COUNT(PixelsTested, std::popcount(static_cast<unsigned>(_mm256_movemask_pd(inside))));
+#endif
+
+#ifdef TINYRENDERER_FLOAT
+        const __m128 depth = _mm_loadu_ps(zspan + (x - x0));
+        const __m128 pass = _mm_and_ps(inside, _mm_cmpgt_ps(z, depth));
+        const int bits = _mm_movemask_ps(pass);
+        if (!bits)
+            continue;
+
+        _mm_storeu_ps(zspan + (x - x0), _mm_blendv_ps(depth, z, pass));
+#else
+        const __m256d depth = _mm256_loadu_pd(zspan + (x - x0));
+        const __m256d pass = _mm256_and_pd(inside, _mm256_cmp_pd(z, depth, _CMP_GT_OQ));
+        const int bits = _mm256_movemask_pd(pass);
+        if (!bits)
+            continue;
+
+        _mm256_storeu_pd(zspan + (x - x0), _mm256_blendv_pd(depth, z, pass));
+#endif
+        mask |= static_cast<std::uint64_t>(bits) << (x - x0);
+    }
+    if (x <= x1) {
+        mask |= depthTestSpanFixedScalar(tri, y, x, x1, zspan + (x - x0)) << (x - x0);
+    }
+    return mask;
+}
+#endif
+
+// Keeps the part of the convex polygon in where plane * position + offset >= 0 and
+// returns its number of vertices
+int clipPolygon(const detail::ClipVertex* in, const int n, const Vec4& plane, const Real offset, detail::ClipVertex* out) {
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        const detail::ClipVertex& a = in[i];
+        const detail::ClipVertex& b = in[(i + 1) % n];
+        const Real da = plane * a.position + offset;
+        const Real db = plane * b.position + offset;
+        if (da >= 0) {
+            out[m++] = a;
+        }
+        if ((da >= 0) != (db >= 0)) {
+            const Real t = da / (da - db);
+            out[m++] = {a.position + (b.position - a.position) * t, a.weights + (b.weights - a.weights) * t};
+        }
+    }
+    return m;
+}
+
+SimdLevel supportedSimdLevel() {
+#ifdef TINYRENDERER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// SSE2 has no 64-bit compare, so fixed-point coverage falls back to the scalar kernel
+SpanKernel spanKernel(const SimdLevel level, const CoverageMode mode) {
+    if (mode == CoverageMode::FixedPoint) {
+#ifdef TINYRENDERER_X86_SIMD
+        if (level == SimdLevel::AVX2)
+            return depthTestSpanFixedAVX2;
+#endif
+        return depthTestSpanFixedScalar;
+    }
+    switch (level) {
+#ifdef TINYRENDERER_X86_SIMD
+    case SimdLevel::AVX2:
+        return depthTestSpanAVX2;
+    case SimdLevel::SSE2:
+        return depthTestSpanSSE2;
+#endif
+    default:
+        return depthTestSpanScalar;
+    }
+}
+
+// Fill kernels test no edges, so they are the same in both coverage modes
+SpanKernel fillKernel(const SimdLevel level) {
+    switch (level) {
+#ifdef TINYRENDERER_X86_SIMD
+    case SimdLevel::AVX2:
+        return depthFillSpanAVX2;
+    case SimdLevel::SSE2:
+        return depthFillSpanSSE2;
+#endif
+    default:
+        return depthFillSpanScalar;
+    }
+}
+
+SimdLevel activeSimdLevel = supportedSimdLevel();
+CoverageMode activeCoverageMode = CoverageMode::FloatingPoint;
+SpanKernel activeSpanKernel = spanKernel(activeSimdLevel, activeCoverageMode);
+SpanKernel activeFillKernel = fillKernel(activeSimdLevel);
+
+// Whether tri covers every pixel of [x0, x1] x [y0, y1]. The corners are evaluated the
+// same way as in the span kernels, where the edges are monotonic in x and in y, so when
+// the corners are inside every pixel is.
+bool coversRect(const detail::TrianglePlanes& tri, const int x0, const int y0, const int x1, const int y1) {
+    for (int i = 0; i < 3; ++i) {
+        for (const int y : {y0, y1}) {
+            if (activeCoverageMode == CoverageMode::FixedPoint) {
+                const std::int64_t row = tri.edge_dy[i] * y + tri.edge_c[i];
+                if (tri.edge_dx[i] * x0 + row < 0 || tri.edge_dx[i] * x1 + row < 0) {
+                    return false;
+                }
+            } else {
+                const Real row = tri.dy[i] * y + tri.c[i];
+                if (!(tri.dx[i] * x0 + row >= 0 && tri.dx[i] * x1 + row >= 0)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// detail::rasterizeTile() with nothing to shade: only the depth hierarchy is updated,
+// and blocks the triangle covers entirely go through the fill kernel
+void rasterizeDepthTile(const detail::TrianglePlanes& tri, const detail::Rect& rect, ZBuffer& zbuffer) {
+    constexpr int B = ZBuffer::BlockSize;
+    const int x0 = std::max(tri.bbox.x0, rect.x0);
+    const int x1 = std::min(tri.bbox.x1, rect.x1);
+    const int y0 = std::max(tri.bbox.y0, rect.y0);
+    const int y1 = std::min(tri.bbox.y1, rect.y1);
+    const int tx = rect.x0 / TileSize;
+    const int ty = rect.y0 / TileSize;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    if (detail::nearestDepth(tri, x0, y0, x1, y1) <= zbuffer.tileMin(tx, ty)) {
+        PROFILE_COUNT(PixelsHiZRejected, detail::coveredPixels(tri, x0, y0, x1, y1));
+        return;
+    }
+
+    bool written = false;
+    for (int by = y0 / B; by <= y1 / B; ++by) {
+        const int ry0 = std::max(y0, by * B);
+        const int ry1 = std::min(y1, by * B + B - 1);
+        for (int bx = x0 / B; bx <= x1 / B; ++bx) {
+            const int rx0 = std::max(x0, bx * B);
+            const int rx1 = std::min(x1, bx * B + B - 1);
+            if (detail::nearestDepth(tri, rx0, ry0, rx1, ry1) <= zbuffer.blockMin(bx, by)) {
+                PROFILE_COUNT(PixelsHiZRejected, detail::coveredPixels(tri, rx0, ry0, rx1, ry1));
+                continue;
+            }
+            const SpanKernel kernel = coversRect(tri, rx0, ry0, rx1, ry1) ? activeFillKernel : activeSpanKernel;
+            std::uint64_t block_written = 0;
+            for (int y = ry0; y <= ry1; ++y) {
+                const std::uint64_t mask = kernel(tri, y, rx0, rx1, zbuffer.span(rx0, y));
+                PROFILE_COUNT(PixelsWritten, std::popcount(mask));
+                block_written |= mask;
+            }
+            if (block_written) {
+                zbuffer.updateBlock(bx, by);
+                written = true;
+            }
+        }
+    }
+    if (written) {
+        zbuffer.updateTile(tx, ty);
+    }
+}
+
+// Fills clip with transform * vertex(i) for i in [0, n)
+template <typename Vertex>
+void transformInto(const Matrix<4, 4>& transform, const std::size_t n, Vertex&& vertex, ClipBuffer& clip) {
+    PROFILE_SCOPE("transform");
+    clip.x.resize(n);
+    clip.y.resize(n);
+    clip.z.resize(n);
+    clip.w.resize(n);
+
+    // Hoisting the matrix and output pointers into locals lets the compiler vectorize the
+    // loop without worrying about aliasing.
+    const Matrix<4, 4> m = transform;
+    Real* const out[4] = {clip.x.data(), clip.y.data(), clip.z.data(), clip.w.data()};
+
+#pragma omp parallel for simd schedule(static) if (n >= ParallelVertexThreshold)
+    for (std::size_t i = 0; i < n; ++i) {
+        const Vec3& v = vertex(i);
+        const Real vx = v.x;
+        const Real vy = v.y;
+        const Real vz = v.z;
+        out[0][i] = m[0].x * vx + m[0].y * vy + m[0].z * vz + m[0].w;
+        out[1][i] = m[1].x * vx + m[1].y * vy + m[1].z * vz + m[1].w;
+        out[2][i] = m[2].x * vx + m[2].y * vy + m[2].z * vz + m[2].w;
+        out[3][i] = m[3].x * vx + m[3].y * vy + m[3].z * vz + m[3].w;
+    }
+}
+
+}
+
+SimdLevel simdLevel() {
+    return activeSimdLevel;
+}
+
+void setSimdLevel(const SimdLevel level) {
+    activeSimdLevel = std::min(level, supportedSimdLevel());
+    activeSpanKernel = spanKernel(activeSimdLevel, activeCoverageMode);
+    activeFillKernel = fillKernel(activeSimdLevel);
+}
+
+CoverageMode coverageMode() {
+    return activeCoverageMode;
+}
+
+void setCoverageMode(const CoverageMode mode) {
+    activeCoverageMode = mode;
+    activeSpanKernel = spanKernel(activeSimdLevel, activeCoverageMode);
+}
+
+void perspective(const Real focal) {
     Perspective = {{{1, 0, 0, 0},
                     {0, 1, 0, 0},
                     {0, 0, 1, 0},
@@ -12,8 +607,8 @@ void perspective(const double focal) {
 }
 
 void viewport(const int x, const int y, const int w, const int h) {
-    Viewport = {{{w / 2., 0, 0, x + w / 2.},
-                 {0, h / 2., 0, y + h / 2.},
+    Viewport = {{{w / Real{2}, 0, 0, x + w / Real{2}},
+                 {0, h / Real{2}, 0, y + h / Real{2}},
                  {0, 0, 1, 0},
                  {0, 0, 0, 1}}};
 }
@@ -26,7 +621,102 @@ void lookAt(const Vec3& eye, const Vec3& center, const Vec3& up) {
                 * Matrix<4, 4>{{{1, 0, 0, -center.x}, {0, 1, 0, -center.y}, {0, 0, 1, -center.z}, {0, 0, 0, 1}}};
 }
 
-void rasterize(const Vec4 clip[3], std::vector<double>& zbuffer, TGAImage& framebuffer, const TGAColor color) {
+void frustumPlanes(const Matrix<4, 4>& transform, const int width, const int height, Vec4 planes[FrustumPlaneCount]) {
+    // Same planes as in clipTriangle(), carried through transform: a plane c of clip
+    // space is c * transform in the source space
+    const Vec4 w{0, 0, 0, 1};
+    planes[0] = w * transform - w * NearW;
+    planes[1] = Viewport[0] * transform;
+    planes[2] = (w * static_cast<Real>(width) - Viewport[0]) * transform;
+    planes[3] = Viewport[1] * transform;
+    planes[4] = (w * static_cast<Real>(height) - Viewport[1]) * transform;
+}
+
+void drawDepth(const ClipBuffer& clip, std::span<const Face> faces, ZBuffer& zbuffer) {
+    const int width = zbuffer.width();
+    const int height = zbuffer.height();
+    detail::binnedRasterize<detail::TrianglePlanes>(
+        faces.size(), width, height,
+        [&](const std::size_t i, std::pmr::vector<detail::TrianglePlanes>& tris) {
+            detail::setupFace(clip, faces[i], width, height, tris, [](detail::TrianglePlanes&, const Vec3(&)[3]) {});
+        },
+        [&](const detail::TrianglePlanes& tri, const detail::Rect& rect) {
+            rasterizeDepthTile(tri, rect, zbuffer);
+        });
+}
+
+void transformVertices(const Matrix<4, 4>& transform, std::span<const Vec3> vertices, ClipBuffer& clip) {
+    const Vec3* in = vertices.data();
+    transformInto(transform, vertices.size(), [in](const std::size_t i) -> const Vec3& { return in[i]; }, clip);
+}
+
+void transformVertices(const Matrix<4, 4>& transform, std::span<const Vec3> vertices, std::span<const int> indices, ClipBuffer& clip) {
+    const Vec3* in = vertices.data();
+    const int* index = indices.data();
+    transformInto(transform, indices.size(), [in, index](const std::size_t i) -> const Vec3& { return in[index[i]]; }, clip);
+}
+
+namespace detail {
+
+int clipTriangle(const Vec4 clip[3], const int width, const int height, ClipVertex polygon[MaxClipVertices]) {
+    ClipVertex buffer[2][MaxClipVertices];
+    ClipVertex* in = buffer[0];
+    ClipVertex* out = buffer[1];
+    int n = 3;
+    PROFILE_COUNT(TrianglesSubmitted, 1);
+    for (int i = 0; i < 3; ++i) {
+        in[i] = {clip[i], {}};
+        in[i].weights[i] = 1;
+    }
+
+    const Vec4 w{0, 0, 0, 1};
+    bool clipped = false;
+    if (clip[0].w < NearW || clip[1].w < NearW || clip[2].w < NearW) {
+        n = clipPolygon(in, n, w, -NearW, out);
+        std::swap(in, out);
+        clipped = true;
+    }
+
+    // With w > 0, a screen coordinate s = (row * position) / w is above a bound when
+    // row * position - bound * w is positive. Index 0 tests x, index 1 tests y.
+    const Vec4 rows[2] = {Viewport[0], Viewport[1]};
+    const Real sizes[2] = {static_cast<Real>(width), static_cast<Real>(height)};
+    for (int axis = 0; axis < 2; ++axis) {
+        bool below = true, above = true;
+        for (int i = 0; i < n; ++i) {
+            const Real s = rows[axis] * in[i].position;
+            below = below && s < 0;
+            above = above && s > sizes[axis] * in[i].position.w;
+        }
+        if (below || above) {
+            PROFILE_COUNT(TrianglesOutside, 1);
+            return 0;
+        }
+    }
+
+    for (int axis = 0; axis < 2; ++axis) {
+        const Vec4 lower = rows[axis] + w * GuardBand;
+        const Vec4 upper = w * (sizes[axis] + GuardBand) - rows[axis];
+        for (const Vec4& plane : {lower, upper}) {
+            bool inside = true;
+            for (int i = 0; i < n; ++i) {
+                inside = inside && plane * in[i].position >= 0;
+            }
+            if (!inside) {
+                n = clipPolygon(in, n, plane, 0, out);
+                std::swap(in, out);
+                clipped = true;
+            }
+        }
+    }
+    if (clipped) {
+        PROFILE_COUNT(TrianglesClipped, 1);
+    }
+    std::copy(in, in + n, polygon);
+    return n;
+}
+
+bool setupTriangle(const Vec4 clip[3], const int width, const int height, TrianglePlanes& tri) {
     Vec4 ndc[3] = {clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w};
     Vec2 screen[3] = {
         (Viewport * ndc[0]).xy(),
@@ -34,30 +724,94 @@ void rasterize(const Vec4 clip[3], std::vector<double>& zbuffer, TGAImage& frame
         (Viewport * ndc[2]).xy(),
     };
 
+    const bool fixed = activeCoverageMode == CoverageMode::FixedPoint;
+    std::int64_t sx[3], sy[3];
+    if (fixed) {
+        // Snapping to the subpixel grid; the planes below are set up from the snapped
+        // positions too, so depth and varyings agree with the coverage
+        for (int i = 0; i < 3; ++i) {
+            if (!(std::abs(screen[i].x) <= MaxFixedCoordinate && std::abs(screen[i].y) <= MaxFixedCoordinate)) {
+                return false;
+            }
+            sx[i] = std::llround(screen[i].x * SubpixelScale);
+            sy[i] = std::llround(screen[i].y * SubpixelScale);
+            screen[i] = {sx[i] / SubpixelScale, sy[i] / SubpixelScale};
+        }
+        // Backface culling on the exact doubled area, in subpixels squared
+        const std::int64_t area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if (area < std::int64_t{1} << (2 * SubpixelBits)) {
+            PROFILE_COUNT(TrianglesBackfacing, 1);
+            return false;
+        }
+    }
+
     Matrix<3, 3> ABC{{{screen[0].x, screen[0].y, 1.0},
                       {screen[1].x, screen[1].y, 1.0},
                       {screen[2].x, screen[2].y, 1.0}}};
 
     // Backface culling
-    if (ABC.det() < 1) {
-        return;
+    if (!fixed && ABC.det() < 1) {
+        PROFILE_COUNT(TrianglesBackfacing, 1);
+        return false;
     }
 
     auto [bbminx, bbmaxx] = std::minmax({screen[0].x, screen[1].x, screen[2].x});
     auto [bbminy, bbmaxy] = std::minmax({screen[0].y, screen[1].y, screen[2].y});
-    for (auto x = std::max<std::size_t>(bbminx, 0); x <= std::min<std::size_t>(bbmaxx, framebuffer.width() - 1); ++x) {
-        for (auto y = std::max<std::size_t>(bbminy, 0); y <= std::min<std::size_t>(bbmaxy, framebuffer.height() - 1); ++y) {
-            Vec3 bc = ABC.invertTranspose() * Vec3{static_cast<double>(x), static_cast<double>(y), 1.};
+    tri.bbox = {std::max(static_cast<int>(bbminx), 0),
+                std::max(static_cast<int>(bbminy), 0),
+                std::min(static_cast<int>(bbmaxx), width - 1),
+                std::min(static_cast<int>(bbmaxy), height - 1)};
+    if (tri.bbox.x0 > tri.bbox.x1 || tri.bbox.y0 > tri.bbox.y1) {
+        return false;
+    }
 
-            if (bc.x < 0 || bc.y < 0 || bc.z < 0)
-                continue;
+    const Matrix<3, 3> edges = ABC.invertTranspose();
+    const Vec3 zplane = Vec3{ndc[0].z, ndc[1].z, ndc[2].z} * edges;
+    for (int i = 0; i < 3; ++i) {
+        tri.dx[i] = edges[i].x;
+        tri.dy[i] = edges[i].y;
+        tri.c[i] = edges[i].z;
+        tri.inv_w[i] = 1 / clip[i].w;
+    }
+    tri.dx[3] = zplane.x;
+    tri.dy[3] = zplane.y;
+    tri.c[3] = zplane.z;
 
-            double z = bc * Vec3{ndc[0].z, ndc[1].z, ndc[2].z};
-            if (z <= zbuffer[x + y * framebuffer.width()])
-                continue;
+    if (fixed) {
+        // Edge i is the doubled area of the triangle formed by the pixel and the two other
+        // corners, expanded into an affine function of the pixel position
+        for (int i = 0; i < 3; ++i) {
+            const int j = (i + 1) % 3;
+            const int k = (i + 2) % 3;
+            tri.edge_dx[i] = (sy[j] - sy[k]) << SubpixelBits;
+            tri.edge_dy[i] = (sx[k] - sx[j]) << SubpixelBits;
+            tri.edge_c[i] = sx[j] * sy[k] - sx[k] * sy[j];
+        }
+    }
+    PROFILE_COUNT(TrianglesRasterized, 1);
+    return true;
+}
 
-            zbuffer[x + y * framebuffer.width()] = z;
-            framebuffer.set(x, y, color);
+std::uint64_t depthTestSpan(const TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan) {
+    return activeSpanKernel(tri, y, x0, x1, zspan);
+}
+
+std::uint64_t coveredPixels(const TrianglePlanes& tri, const int x0, const int y0, const int x1, const int y1) {
+    std::uint64_t covered = 0;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            bool inside = true;
+            for (int i = 0; i < 3 && inside; ++i) {
+                if (activeCoverageMode == CoverageMode::FixedPoint) {
+                    inside = tri.edge_dx[i] * x + (tri.edge_dy[i] * y + tri.edge_c[i]) >= 0;
+                } else {
+                    inside = tri.dx[i] * x + (tri.dy[i] * y + tri.c[i]) >= 0;
+                }
+            }
+            covered += inside;
         }
     }
+    return covered;
+}
+
 }
@@ -1,12 +1,539 @@
+#pragma once
+
+#include "frame_arena.h"
 #include "matrix.h"
+#include "model.h"
+#include "profile.h"
+#include "render_target.h"
 #include "tgaimage.h"
 #include "vector.h"
+#include "zbuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 inline Matrix<4, 4> Viewport;
 inline Matrix<4, 4> Modelview;
 inline Matrix<4, 4> Perspective;
 
-void perspective(const double focal);
+// Instruction sets the span kernels of the rasterizer can use, in increasing order
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// How the rasterizer decides which pixels a triangle covers
+enum class CoverageMode {
+    // Edge functions evaluated in Real, like the rest of the pipeline
+    FloatingPoint,
+    // Screen positions snapped to 24.8 fixed point and edge functions evaluated exactly
+    // in 64-bit integers, so coverage is bit-reproducible across compilers and CPUs.
+    FixedPoint,
+};
+
+// Clip-space positions of a whole vertex array, stored as one array per component so
+// the vertex stage can fill them with full-width vector stores
+struct ClipBuffer {
+    ClipBuffer() = default;
+    // Copy of other with its arrays allocated from resource
+    ClipBuffer(const ClipBuffer& other, std::pmr::memory_resource* resource)
+        : x(other.x, resource), y(other.y, resource), z(other.z, resource), w(other.w, resource) {
+    }
+
+    std::pmr::vector<Real> x, y, z, w;
+
+    std::size_t size() const {
+        return w.size();
+    }
+    Vec4 operator[](const std::size_t i) const {
+        return {x[i], y[i], z[i], w[i]};
+    }
+};
+
+// A shader provides the per-vertex and per-pixel stages of draw():
+//   Varyings vertex(int face, int corner) const  outputs of one corner of a face
+//   TGAColor fragment(const Varyings&) const     colour of a covered pixel
+// The fragment stage may instead take (in, ddx, ddy), the varyings and their rates of
+// change per pixel along x and y, e.g. to pick the mip level of a texture.
+// Varyings must be a struct made only of Reals (Vec2/Vec3/Real members), which
+// draw() interpolates member-wise and perspective-correctly. draw() is a template over
+// the shader, so both stages are inlined into the rasterizer loops and no pixel pays
+// for an indirect call.
+template <typename Shader>
+concept ShaderWithDerivatives = requires(const Shader& shader, const typename Shader::Varyings& in) {
+    { shader.fragment(in, in, in) } -> std::same_as<TGAColor>;
+};
+
+template <typename Shader>
+concept ShaderType = requires(const Shader& shader) {
+    { shader.vertex(0, 0) } -> std::same_as<typename Shader::Varyings>;
+} && (ShaderWithDerivatives<Shader> || requires(const Shader& shader, const typename Shader::Varyings& in) {
+    { shader.fragment(in) } -> std::same_as<TGAColor>;
+});
+
+// The best level the CPU supports is picked at start-up; setSimdLevel() can lower it
+// (e.g. to compare kernels) but never raises it above what the CPU supports. It must
+// not be called while a frame is being rasterized.
+SimdLevel simdLevel();
+void setSimdLevel(const SimdLevel level);
+// Like setSimdLevel(), must not be called while a frame is being rasterized
+CoverageMode coverageMode();
+void setCoverageMode(const CoverageMode mode);
+
+void perspective(const Real focal);
 void viewport(const int x, const int y, const int w, const int h);
 void lookAt(const Vec3& eye, const Vec3& center, const Vec3& up);
-void rasterize(const Vec4 clip[3], std::vector<double>& zbuffer, TGAImage& framebuffer, const TGAColor color);
+// Planes bounding the region clipTriangle() keeps for a width x height framebuffer: the
+// near plane and the four planes through the eye and the edges of the framebuffer,
+// expressed in the space that transform maps to clip space. A point p of that space is
+// in the region when plane * (p, 1) >= 0 for every plane.
+constexpr int FrustumPlaneCount = 5;
+void frustumPlanes(const Matrix<4, 4>& transform, const int width, const int height, Vec4 planes[FrustumPlaneCount]);
+// Transforms every vertex once, so triangles sharing a vertex reuse its clip position
+void transformVertices(const Matrix<4, 4>& transform, std::span<const Vec3> vertices, ClipBuffer& clip);
+// Transforms the subset vertices[indices[i]] of a vertex array into clip[i], e.g. the
+// vertices of the visible meshlets of a mesh
+void transformVertices(const Matrix<4, 4>& transform, std::span<const Vec3> vertices, std::span<const int> indices, ClipBuffer& clip);
+
+namespace detail {
+
+// Inclusive pixel rectangle
+struct Rect {
+    int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+};
+
+// Screen-space data computed once per triangle and shared by every tile it overlaps.
+// Planes 0-2 are the screen-space barycentric coordinates and plane 3 is the depth,
+// each one an affine function dx * x + dy * y + c of the pixel position.
+struct TrianglePlanes {
+    Real dx[4];
+    Real dy[4];
+    Real c[4];
+    Real inv_w[3];
+    // Planes 0-2 scaled to integers in CoverageMode::FixedPoint, in subpixels squared
+    std::int64_t edge_dx[3];
+    std::int64_t edge_dy[3];
+    std::int64_t edge_c[3];
+    Rect bbox;
+};
+
+template <typename Varyings>
+struct ShadedTriangle : TrianglePlanes {
+    Varyings varyings[3];
+};
+
+// Largest number of vertices clipTriangle() outputs: every clipping plane can add one
+constexpr int MaxClipVertices = 8;
+
+// A vertex of a clipped triangle, with the weights of the triangle's corners that
+// produce its varyings
+struct ClipVertex {
+    Vec4 position;
+    Vec3 weights;
+};
+
+// Clips a triangle to the near plane and, where it leaves the guard band around the
+// framebuffer, to the guard band, so that setupTriangle() only ever sees finite screen
+// positions of bounded size. Returns the number of vertices of the resulting convex
+// polygon, which is 0 when the triangle lies entirely outside the view.
+int clipTriangle(const Vec4 clip[3], const int width, const int height, ClipVertex polygon[MaxClipVertices]);
+
+// Projects a triangle with w > 0 at every corner to the screen. Returns false when it is back-facing or does not
+// cover any pixel of a width x height framebuffer.
+bool setupTriangle(const Vec4 clip[3], const int width, const int height, TrianglePlanes& tri);
+
+// Depth-tests pixels [x0, x1] of row y (x1 - x0 < 64) against the depths zspan[0, x1 -
+// x0] and stores the depth of those that pass, which are returned as a bit mask
+// relative to x0.
+std::uint64_t depthTestSpan(const TrianglePlanes& tri, const int y, const int x0, const int x1, Real* zspan);
+
+// Pixels of [x0, x1] x [y0, y1] that tri covers, as the span kernels decide it. Only the
+// profiler calls it, to count the pixels the depth hierarchy rejects without testing.
+std::uint64_t coveredPixels(const TrianglePlanes& tri, const int x0, const int y0, const int x1, const int y1);
+
+template <typename Varyings>
+Varyings interpolate(const Varyings (&v)[3], const Real b0, const Real b1, const Real b2) {
+    constexpr std::size_t N = sizeof(Varyings) / sizeof(Real);
+    static_assert(std::is_trivially_copyable_v<Varyings> && sizeof(Varyings) == N * sizeof(Real),
+                  "Varyings must only contain Reals");
+    using Values = std::array<Real, N>;
+    const Values a = std::bit_cast<Values>(v[0]);
+    const Values b = std::bit_cast<Values>(v[1]);
+    const Values c = std::bit_cast<Values>(v[2]);
+    Values ret;
+    for (std::size_t i = 0; i < N; ++i) {
+        ret[i] = a[i] * b0 + b[i] * b1 + c[i] * b2;
+    }
+    return std::bit_cast<Varyings>(ret);
+}
+
+// Largest depth the span kernels can compute for a pixel of [x0, x1] x [y0, y1]. The
+// computed depth is monotonic in x and in y, so it is the largest one at the corners.
+inline Real nearestDepth(const TrianglePlanes& tri, const int x0, const int y0, const int x1, const int y1) {
+    const Real row0 = tri.dy[3] * y0 + tri.c[3];
+    const Real row1 = tri.dy[3] * y1 + tri.c[3];
+    return std::max({tri.dx[3] * x0 + row0, tri.dx[3] * x1 + row0, tri.dx[3] * x0 + row1, tri.dx[3] * x1 + row1});
+}
+
+// Sample positions of the multisample patterns, in 1/16 pixel from the pixel position:
+// the standard 2x, 4x rotated grid and 8x sparse grid patterns, which never put two
+// samples on the same row or column
+template <int Samples>
+constexpr std::array<std::array<int, 2>, Samples> samplePattern() {
+    if constexpr (Samples == 1) {
+        return {{{0, 0}}};
+    } else if constexpr (Samples == 2) {
+        return {{{4, 4}, {-4, -4}}};
+    } else if constexpr (Samples == 4) {
+        return {{{-2, -6}, {6, -2}, {-6, 2}, {2, 6}}};
+    } else {
+        static_assert(Samples == 8);
+        return {{{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}}};
+    }
+}
+
+// tri with every plane moved so that evaluating it at a pixel gives its value at
+// (ox, oy) / 16 pixel from there. The fixed-point edges stay exact, as their steps are
+// multiples of the subpixel scale.
+inline TrianglePlanes offsetPlanes(const TrianglePlanes& tri, const int ox, const int oy) {
+    TrianglePlanes ret = tri;
+    for (int i = 0; i < 4; ++i) {
+        ret.c[i] += (tri.dx[i] * ox + tri.dy[i] * oy) / 16;
+    }
+    for (int i = 0; i < 3; ++i) {
+        ret.edge_c[i] += (tri.edge_dx[i] * ox + tri.edge_dy[i] * oy) / 16;
+    }
+    return ret;
+}
+
+// Walks the part of tri inside rect (a tile) block by block, skipping the tile and then
+// any block whose farthest stored depth is in front of the triangle, and calls
+// shade(x, y) for every pixel passing the depth test.
+template <typename Shade>
+void rasterizeTile(const TrianglePlanes& tri, const Rect& rect, ZBuffer& zbuffer, Shade&& shade) {
+    constexpr int B = ZBuffer::BlockSize;
+    const int x0 = std::max(tri.bbox.x0, rect.x0);
+    const int x1 = std::min(tri.bbox.x1, rect.x1);
+    const int y0 = std::max(tri.bbox.y0, rect.y0);
+    const int y1 = std::min(tri.bbox.y1, rect.y1);
+    const int tx = rect.x0 / TileSize;
+    const int ty = rect.y0 / TileSize;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    if (nearestDepth(tri, x0, y0, x1, y1) <= zbuffer.tileMin(tx, ty)) {
+        PROFILE_COUNT(PixelsHiZRejected, coveredPixels(tri, x0, y0, x1, y1));
+        return;
+    }
+
+    bool written = false;
+    for (int by = y0 / B; by <= y1 / B; ++by) {
+        const int ry0 = std::max(y0, by * B);
+        const int ry1 = std::min(y1, by * B + B - 1);
+        for (int bx = x0 / B; bx <= x1 / B; ++bx) {
+            const int rx0 = std::max(x0, bx * B);
+            const int rx1 = std::min(x1, bx * B + B - 1);
+            if (nearestDepth(tri, rx0, ry0, rx1, ry1) <= zbuffer.blockMin(bx, by)) {
+                PROFILE_COUNT(PixelsHiZRejected, coveredPixels(tri, rx0, ry0, rx1, ry1));
+                continue;
+            }
+            std::uint64_t block_written = 0;
+            for (int y = ry0; y <= ry1; ++y) {
+                const std::uint64_t mask = depthTestSpan(tri, y, rx0, rx1, zbuffer.span(rx0, y));
+                PROFILE_COUNT(PixelsWritten, std::popcount(mask));
+                block_written |= mask;
+                for (std::uint64_t bits = mask; bits; bits &= bits - 1) {
+                    shade(rx0 + std::countr_zero(bits), y);
+                }
+            }
+            if (block_written) {
+                zbuffer.updateBlock(bx, by);
+                written = true;
+            }
+        }
+    }
+    if (written) {
+        zbuffer.updateTile(tx, ty);
+    }
+}
+
+// Walks the part of tri inside rect like rasterizeTile(), testing every sample of the
+// pattern against its own depths, and calls shade(x, y, mask) once for every pixel
+// with at least one sample passing the depth test, mask holding those samples.
+template <int Samples, typename Shade>
+void rasterizeTileMultisample(const TrianglePlanes& tri, const Rect& rect, std::span<ZBuffer, Samples> zbuffers, Shade&& shade) {
+    constexpr int B = ZBuffer::BlockSize;
+    constexpr auto pattern = samplePattern<Samples>();
+    const int x0 = std::max(tri.bbox.x0, rect.x0);
+    const int x1 = std::min(tri.bbox.x1, rect.x1);
+    const int y0 = std::max(tri.bbox.y0, rect.y0);
+    const int y1 = std::min(tri.bbox.y1, rect.y1);
+    const int tx = rect.x0 / TileSize;
+    const int ty = rect.y0 / TileSize;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    // The samples of the tile still in front of something, each with the planes moved
+    // to its position so the span kernels evaluate them there
+    TrianglePlanes sample_tris[Samples];
+    std::uint32_t tile_samples = 0;
+    for (int i = 0; i < Samples; ++i) {
+        sample_tris[i] = offsetPlanes(tri, pattern[i][0], pattern[i][1]);
+        if (nearestDepth(sample_tris[i], x0, y0, x1, y1) > zbuffers[i].tileMin(tx, ty)) {
+            tile_samples |= 1u << i;
+        } else {
+            PROFILE_COUNT(PixelsHiZRejected, coveredPixels(sample_tris[i], x0, y0, x1, y1));
+        }
+    }
+    if (!tile_samples) {
+        return;
+    }
+
+    std::uint32_t tile_written = 0;
+    for (int by = y0 / B; by <= y1 / B; ++by) {
+        const int ry0 = std::max(y0, by * B);
+        const int ry1 = std::min(y1, by * B + B - 1);
+        for (int bx = x0 / B; bx <= x1 / B; ++bx) {
+            const int rx0 = std::max(x0, bx * B);
+            const int rx1 = std::min(x1, bx * B + B - 1);
+            std::uint32_t block_samples = 0;
+            for (std::uint32_t bits = tile_samples; bits; bits &= bits - 1) {
+                const int i = std::countr_zero(bits);
+                if (nearestDepth(sample_tris[i], rx0, ry0, rx1, ry1) > zbuffers[i].blockMin(bx, by)) {
+                    block_samples |= 1u << i;
+                } else {
+                    PROFILE_COUNT(PixelsHiZRejected, coveredPixels(sample_tris[i], rx0, ry0, rx1, ry1));
+                }
+            }
+            if (!block_samples) {
+                continue;
+            }
+            std::uint32_t block_written = 0;
+            for (int y = ry0; y <= ry1; ++y) {
+                std::uint64_t masks[Samples] = {};
+                std::uint64_t any = 0;
+                for (std::uint32_t bits = block_samples; bits; bits &= bits - 1) {
+                    const int i = std::countr_zero(bits);
+                    masks[i] = depthTestSpan(sample_tris[i], y, rx0, rx1, zbuffers[i].span(rx0, y));
+                    block_written |= static_cast<std::uint32_t>(masks[i] != 0) << i;
+                    any |= masks[i];
+                }
+                PROFILE_COUNT(PixelsWritten, std::popcount(any));
+                // Transposes the per-sample pixel masks into a sample mask per pixel
+                for (std::uint64_t bits = any; bits; bits &= bits - 1) {
+                    const int x = std::countr_zero(bits);
+                    std::uint32_t coverage = 0;
+                    for (int i = 0; i < Samples; ++i) {
+                        coverage |= static_cast<std::uint32_t>((masks[i] >> x) & 1) << i;
+                    }
+                    shade(rx0 + x, y, coverage);
+                }
+            }
+            for (std::uint32_t bits = block_written; bits; bits &= bits - 1) {
+                zbuffers[std::countr_zero(bits)].updateBlock(bx, by);
+            }
+            tile_written |= block_written;
+        }
+    }
+    for (std::uint32_t bits = tile_written; bits; bits &= bits - 1) {
+        zbuffers[std::countr_zero(bits)].updateTile(tx, ty);
+    }
+}
+
+// Runs the fragment stage of shader for pixel (x, y) of tri
+template <typename Shader>
+TGAColor shadePixel(const Shader& shader, const ShadedTriangle<typename Shader::Varyings>& tri, const int x, const int y) {
+    PROFILE_COUNT(PixelsShaded, 1);
+    // Screen-space barycentrics divided by w give perspective-correct weights
+    Real b[3];
+    for (int i = 0; i < 3; ++i) {
+        b[i] = (tri.dx[i] * x + tri.dy[i] * y + tri.c[i]) * tri.inv_w[i];
+    }
+    const Real sum = b[0] + b[1] + b[2];
+    const Real n[3] = {b[0] / sum, b[1] / sum, b[2] / sum};
+    const auto in = interpolate(tri.varyings, n[0], n[1], n[2]);
+    if constexpr (ShaderWithDerivatives<Shader>) {
+        // Derivatives of the weights n_i = b_i / sum, which are exact for
+        // perspective-correct interpolation
+        const Real dsum_dx = tri.dx[0] * tri.inv_w[0] + tri.dx[1] * tri.inv_w[1] + tri.dx[2] * tri.inv_w[2];
+        const Real dsum_dy = tri.dy[0] * tri.inv_w[0] + tri.dy[1] * tri.inv_w[1] + tri.dy[2] * tri.inv_w[2];
+        Real ddx[3], ddy[3];
+        for (int i = 0; i < 3; ++i) {
+            ddx[i] = (tri.dx[i] * tri.inv_w[i] - n[i] * dsum_dx) / sum;
+            ddy[i] = (tri.dy[i] * tri.inv_w[i] - n[i] * dsum_dy) / sum;
+        }
+        return shader.fragment(in, interpolate(tri.varyings, ddx[0], ddx[1], ddx[2]), interpolate(tri.varyings, ddy[0], ddy[1], ddy[2]));
+    } else {
+        return shader.fragment(in);
+    }
+}
+
+// Multisampled targets shade a pixel once per triangle, at the pixel position, however
+// many of its samples the triangle covers
+template <typename Shader, typename Format, int Samples>
+void shadeTile(const Shader& shader, const ShadedTriangle<typename Shader::Varyings>& tri, const Rect& rect, RenderTarget<Format, Samples>& target) {
+    if constexpr (Samples == 1) {
+        rasterizeTile(tri, rect, target.depth(), [&](const int x, const int y) {
+            target.set(x, y, shadePixel(shader, tri, x, y));
+        });
+    } else {
+        rasterizeTileMultisample<Samples>(tri, rect, target.sampleDepths(), [&](const int x, const int y, const std::uint32_t mask) {
+            if (mask == target.FullMask) {
+                target.set(x, y, shadePixel(shader, tri, x, y));
+            } else {
+                target.set(x, y, shadePixel(shader, tri, x, y), mask);
+            }
+        });
+    }
+}
+
+// Clips face and sets up the visible pieces, appending them to tris. piece(tri, weights)
+// is called for every piece appended, with the weights of the face's corners at the
+// corners of the piece.
+template <typename Tri, typename Piece>
+void setupFace(const ClipBuffer& clip, const Face& face, const int width, const int height, std::pmr::vector<Tri>& tris, Piece&& piece) {
+    const Vec4 corners[3] = {clip[face[0]], clip[face[1]], clip[face[2]]};
+    ClipVertex polygon[MaxClipVertices];
+    const int n = clipTriangle(corners, width, height, polygon);
+    for (int k = 1; k + 1 < n; ++k) {
+        const Vec4 positions[3] = {polygon[0].position, polygon[k].position, polygon[k + 1].position};
+        Tri& tri = tris.emplace_back();
+        if (!setupTriangle(positions, width, height, tri)) {
+            tris.pop_back();
+            continue;
+        }
+        const Vec3 weights[3] = {polygon[0].weights, polygon[k].weights, polygon[k + 1].weights};
+        piece(tri, weights);
+    }
+}
+
+// Sets up num_triangles triangles in parallel, bins them into screen tiles and runs
+// rasterize_tile(tri, rect) for every tile a triangle overlaps, tiles in parallel.
+// setup(i, tris) appends the visible pieces of triangle i, if any, to tris.
+template <typename Tri, typename Setup, typename RasterizeTile>
+void binnedRasterize(const std::size_t num_triangles, const int width, const int height, Setup&& setup, RasterizeTile&& rasterize_tile) {
+    const int tiles_x = (width + TileSize - 1) / TileSize;
+    const int tiles_y = (height + TileSize - 1) / TileSize;
+    const int num_tiles = tiles_x * tiles_y;
+
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+
+    // Every thread sets up a contiguous chunk of triangles into its own list and bins
+    // them into its own per-tile lists, so no synchronisation is needed and reading the
+    // lists back in thread order preserves the submission order within each tile. The
+    // lists are allocated from the frame arena of their thread, and published here for
+    // the other threads to read.
+    std::pmr::vector<const std::pmr::vector<Tri>*> tris(num_threads, nullptr, &frameArena());
+    std::pmr::vector<const std::pmr::vector<std::pmr::vector<int>>*> bins(num_threads, nullptr, &frameArena());
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        int thread = 0;
+        int team_size = 1;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+        team_size = omp_get_num_threads();
+#endif
+        const std::size_t begin = num_triangles * thread / team_size;
+        const std::size_t end = num_triangles * (thread + 1) / team_size;
+        std::pmr::vector<Tri> thread_tris(&frameArena());
+        std::pmr::vector<std::pmr::vector<int>> thread_bins(num_tiles, &frameArena());
+        {
+            PROFILE_SCOPE("setup");
+            thread_tris.reserve(end - begin);
+            for (std::size_t i = begin; i < end; ++i) {
+                const std::size_t first = thread_tris.size();
+                setup(i, thread_tris);
+                for (std::size_t t = first; t < thread_tris.size(); ++t) {
+                    const Rect& bbox = thread_tris[t].bbox;
+                    for (int ty = bbox.y0 / TileSize; ty <= bbox.y1 / TileSize; ++ty) {
+                        for (int tx = bbox.x0 / TileSize; tx <= bbox.x1 / TileSize; ++tx) {
+                            thread_bins[ty * tiles_x + tx].push_back(static_cast<int>(t));
+                        }
+                    }
+                }
+            }
+            tris[thread] = &thread_tris;
+            bins[thread] = &thread_bins;
+        }
+#pragma omp barrier
+
+        // Tiles cover disjoint parts of the render target, so they can be rasterized
+        // concurrently without locks. The lists outlive the loop, which ends with a barrier.
+#pragma omp for schedule(dynamic)
+        for (int tile = 0; tile < num_tiles; ++tile) {
+            PROFILE_SCOPE("raster");
+            const int tx = tile % tiles_x;
+            const int ty = tile / tiles_x;
+            const Rect rect{tx * TileSize,
+                            ty * TileSize,
+                            std::min((tx + 1) * TileSize, width) - 1,
+                            std::min((ty + 1) * TileSize, height) - 1};
+            for (int t = 0; t < team_size; ++t) {
+                for (const int i : (*bins[t])[tile]) {
+                    rasterize_tile((*tris[t])[i], rect);
+                }
+            }
+        }
+    }
+}
+
+}
+
+// Draws the triangles faces (indices into clip) with shader into target. Face i is
+// passed to the shader's vertex stage as face index i.
+template <ShaderType Shader, typename Format, int Samples>
+void draw(const Shader& shader, const ClipBuffer& clip, std::span<const Face> faces, RenderTarget<Format, Samples>& target) {
+    using Tri = detail::ShadedTriangle<typename Shader::Varyings>;
+    const int width = target.width();
+    const int height = target.height();
+    detail::binnedRasterize<Tri>(
+        faces.size(), width, height,
+        [&](const std::size_t i, std::pmr::vector<Tri>& tris) {
+            // The vertex stage runs once the first piece turns out to be visible, and the
+            // varyings of the clipped vertices are blended from those of the corners
+            typename Shader::Varyings varyings[3];
+            bool shaded = false;
+            detail::setupFace(clip, faces[i], width, height, tris, [&](Tri& tri, const Vec3 (&weights)[3]) {
+                if constexpr (Samples > 1) {
+                    // Samples lie within half a pixel of the pixel position, so pixels
+                    // next to the box of pixel positions may have some covered
+                    tri.bbox = {std::max(tri.bbox.x0 - 1, 0), std::max(tri.bbox.y0 - 1, 0),
+                                std::min(tri.bbox.x1 + 1, width - 1), std::min(tri.bbox.y1 + 1, height - 1)};
+                }
+                if (!shaded) {
+                    for (int c = 0; c < 3; ++c) {
+                        varyings[c] = shader.vertex(static_cast<int>(i), c);
+                    }
+                    shaded = true;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    tri.varyings[c] = detail::interpolate(varyings, weights[c].x, weights[c].y, weights[c].z);
+                }
+            });
+        },
+        [&](const Tri& tri, const detail::Rect& rect) {
+            detail::shadeTile(shader, tri, rect, target);
+        });
+}
+
+// Draws only the depth of faces into zbuffer, e.g. for a shadow map. No vertex or
+// fragment stage runs, and blocks a triangle covers entirely skip the coverage tests, so
+// the depths are the same as those draw() writes at a fraction of its cost.
+void drawDepth(const ClipBuffer& clip, std::span<const Face> faces, ZBuffer& zbuffer);
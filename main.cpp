@@ -1,6 +1,132 @@
+#include "deferred.h"
+#include "frame_arena.h"
+#include "frame_stream.h"
+#include "frame_writer.h"
 #include "gl.h"
+#include "matrix.h"
 #include "model.h"
+#include "post.h"
+#include "profile.h"
+#include "render_target.h"
+#include "scene.h"
+#include "shaders.h"
+#include "shadow.h"
+#include "texture.h"
 #include "tgaimage.h"
+#include "vector.h"
+
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Camera of one rendered view, as passed to lookAt() and perspective()
+struct CameraPose {
+    Vec3 eye;
+    Vec3 center;
+    Vec3 up;
+    Real focal;
+};
+
+// Loads the texture stored next to obj/<file_name> with the given suffix instead of the
+// .obj extension, e.g. "_diffuse.tga"
+Texture loadTexture(const std::string& file_name, const std::string& suffix) {
+    TGAImage image;
+    image.read_tga_file("obj/" + file_name.substr(0, file_name.rfind('.')) + suffix);
+    return Texture{image};
+}
+
+// Reads one pose per line: "ex ey ez cx cy cz ux uy uz [focal]". The focal length
+// defaults to the distance from the eye to the center. Empty lines and lines starting
+// with # are skipped.
+bool readPoses(const std::string& file_name, std::vector<CameraPose>& poses) {
+    std::ifstream in(file_name);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << file_name << "\n";
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#') {
+            continue;
+        }
+        fields.seekg(0);
+        CameraPose pose;
+        if (!(fields >> pose.eye.x >> pose.eye.y >> pose.eye.z >> pose.center.x >> pose.center.y >> pose.center.z >> pose.up.x >> pose.up.y >> pose.up.z)) {
+            std::cerr << file_name << ":" << number << ": malformed pose\n";
+            return false;
+        }
+        if (!(fields >> pose.focal)) {
+            pose.focal = norm(pose.eye - pose.center);
+        }
+        poses.push_back(pose);
+    }
+    return true;
+}
+
+// Object to world transform scaling by scale, then turning by yaw degrees around the y
+// axis and moving by translation
+Matrix<4, 4> placement(const Vec3& translation, const Real yaw, const Real scale) {
+    const Real c = std::cos(yaw * std::numbers::pi_v<Real> / 180);
+    const Real s = std::sin(yaw * std::numbers::pi_v<Real> / 180);
+    return {{{c * scale, 0, s * scale, translation.x},
+             {0, scale, 0, translation.y},
+             {-s * scale, 0, c * scale, translation.z},
+             {0, 0, 0, 1}}};
+}
+
+// Reads one instance per line: "file_name [tx ty tz [yaw [scale]]]", with file_name
+// relative to obj/. Instances of the same file share one mesh. Empty lines and lines
+// starting with # are skipped.
+bool readScene(const std::string& file_name, Scene& scene) {
+    std::ifstream in(file_name);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << file_name << "\n";
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields(line);
+        std::string mesh_name;
+        if (!(fields >> mesh_name) || mesh_name[0] == '#') {
+            continue;
+        }
+        // The fields after the name are optional, but those present must all be numbers
+        const auto optional = [&fields](Real& value) {
+            return (fields >> std::ws).eof() || static_cast<bool>(fields >> value);
+        };
+        Vec3 translation;
+        Real yaw = 0;
+        Real scale = 1;
+        const bool placed = (fields >> std::ws).eof()
+                            || (fields >> translation.x >> translation.y >> translation.z && optional(yaw) && optional(scale)
+                                && (fields >> std::ws).eof());
+        if (!placed) {
+            std::cerr << file_name << ":" << number << ": malformed instance\n";
+            return false;
+        }
+        const int mesh = scene.addMesh(mesh_name);
+        if (mesh < 0) {
+            return false;
+        }
+        scene.addInstance(mesh, placement(translation, yaw, scale));
+    }
+    scene.build();
+    return true;
+}
 
 int main(int argc, char** argv) {
     constexpr int width = 800;
@@ -8,43 +134,281 @@ int main(int argc, char** argv) {
     const Vec3 eye{-1, 0, 2};   // Camera position
     const Vec3 center{0, 0, 0}; // Camera direction
     const Vec3 up{0, 1, 0};     // Camera up vector
+    const Vec3 light{1, 1, 1};  // Direction towards the light
+    constexpr std::uint32_t color_seed = 1; // Seed of the flat shading colours
+    constexpr int shadow_map_size = 2048;
+    constexpr Real default_ao_strength = 40;
+    constexpr Real default_exposure = 2;
+    constexpr Real default_gamma = 2.2;
+    constexpr Real default_lod_pixels = 1;
 
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    std::vector<double> zbuffer(width * height, -std::numeric_limits<double>::max());
+    // flat, gouraud, phong or normalmap, optionally followed by options, each after a
+    // colon:
+    //   deferred         shade every pixel once, after all the geometry is rasterized
+    //                    into a visibility buffer
+    //   lod[=pixels]     simplify the meshes at load and draw every instance with the
+    //                    coarsest level of detail whose error spans at most pixels on
+    //                    screen, 1 by default
+    //   optimize         weld and reorder the vertices and faces of the meshes at load
+    //                    for vertex reuse
+    //   shadows[=radius] shadow the light with a shadow map filtered over
+    //                    (2 * radius + 1)^2 texels, radius 1 by default
+    //   ssao[=strength]  darken creases from the depths (ambient occlusion)
+    //   tonemap[=exposure], gamma[=gamma], fxaa
+    //                    tone mapping, gamma encoding and edge smoothing
+    // The last four run in one pass over the rendered colours and depths.
+    std::string shading = argc > 1 ? argv[1] : "normalmap";
+    bool deferred = false;
+    bool optimize = false;
+    Real lod_pixels = -1;
+    int shadow_radius = -1;
+    PostSettings post_settings;
+    std::istringstream shading_options(shading);
+    std::getline(shading_options, shading, ':');
+    for (std::string option; std::getline(shading_options, option, ':');) {
+        const std::size_t equals = option.find('=');
+        const std::string name = option.substr(0, equals);
+        const bool valued = equals != std::string::npos;
+        const Real value = valued ? std::atof(option.c_str() + equals + 1) : 0;
+        if (name == "deferred" && !valued) {
+            deferred = true;
+        } else if (name == "optimize" && !valued) {
+            optimize = true;
+        } else if (name == "lod" && value >= 0) {
+            lod_pixels = valued ? value : default_lod_pixels;
+        } else if (name == "shadows" && value >= 0) {
+            shadow_radius = valued ? static_cast<int>(value) : 1;
+        } else if (name == "ssao" && value >= 0) {
+            post_settings.ao_strength = valued ? value : default_ao_strength;
+        } else if (name == "tonemap" && value >= 0) {
+            post_settings.exposure = valued ? value : default_exposure;
+        } else if (name == "gamma" && (!valued || value > 0)) {
+            post_settings.gamma = valued ? value : default_gamma;
+        } else if (name == "fxaa" && !valued) {
+            post_settings.fxaa = true;
+        } else {
+            std::cerr << "unknown shading option " << option << "\n";
+            return 1;
+        }
+    }
+    const PostProcess post(post_settings);
+    if (shading != "flat" && shading != "gouraud" && shading != "phong" && shading != "normalmap") {
+        std::cerr << "unknown shading " << shading << "\n";
+        return 1;
+    }
+    // float or fixed, the arithmetic deciding which pixels a triangle covers, optionally
+    // followed by :2, :4 or :8 to multisample with as many samples per pixel
+    std::string coverage = argc > 2 ? argv[2] : "float";
+    int samples = 1;
+    if (const std::size_t colon = coverage.find(':'); colon != std::string::npos) {
+        samples = std::atoi(coverage.c_str() + colon + 1);
+        coverage.resize(colon);
+    }
+    if (coverage == "fixed") {
+        setCoverageMode(CoverageMode::FixedPoint);
+    } else if (coverage != "float") {
+        std::cerr << "unknown coverage " << coverage << "\n";
+        return 1;
+    }
+    if (samples != 1 && samples != 2 && samples != 4 && samples != 8) {
+        std::cerr << "unsupported sample count " << samples << "\n";
+        return 1;
+    }
+    if (deferred && samples != 1) {
+        std::cerr << "deferred shading does not multisample\n";
+        return 1;
+    }
+    // With a file of camera poses every pose is rendered to frame_NNNN.tga, otherwise
+    // (or with -) the default view is rendered to framebuffer.tga
+    const bool batch = argc > 3 && std::string{argv[3]} != "-";
+    std::vector<CameraPose> poses;
+    if (batch) {
+        if (!readPoses(argv[3], poses)) {
+            return 1;
+        }
+    } else {
+        poses.push_back({eye, center, up, norm(eye - center)});
+    }
 
-    Model model;
-    std::string file_name{"african_head/african_head.obj"};
-    model.loadVerticesFromObj(file_name);
-    model.loadFacesFromObjs(file_name);
-    model.loadNormalsFromObj(file_name);
+    // A scene file places any number of instances of the meshes in obj/, the default
+    // scene (or -) is one head
+    Scene scene;
+    scene.setOptimizeMeshes(optimize);
+    scene.setGenerateLods(lod_pixels >= 0);
+    if (argc > 4 && std::string{argv[4]} != "-") {
+        if (!readScene(argv[4], scene)) {
+            return 1;
+        }
+    } else {
+        const int mesh = scene.addMesh("african_head/african_head.obj");
+        if (mesh < 0) {
+            return 1;
+        }
+        scene.addInstance(mesh, placement({}, 0, 1));
+        scene.build();
+    }
 
-    lookAt(eye, center, up);
-    perspective(norm(eye - center));
-    viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8); // build the Viewport matrix
+    // The light and the scene are the same in every view, so the shadows are rendered once
+    std::optional<ShadowMap> shadow;
+    if (shadow_radius >= 0) {
+        shadow.emplace(shadow_map_size, shadow_radius);
+        shadow->render(scene, light);
+    }
 
-    auto const& vertices = model.getVertices();
-    auto const& faces = model.getVertexFaces();
-    auto const& normals = model.getNormals();
+    // Everything that does not depend on the camera is prepared once per mesh for all
+    // views and instances
+    struct MeshMaterial {
+        std::vector<TGAColor> colors;
+        Texture diffuse, normal_map, specular;
+    };
+    std::vector<MeshMaterial> materials(scene.meshCount());
+    for (int mesh = 0; mesh < scene.meshCount(); ++mesh) {
+        const std::string& file_name = scene.getMeshName(mesh);
+        MeshMaterial& material = materials[mesh];
+        if (shading == "flat") {
+            material.colors = randomColors(scene.getMesh(mesh).getVertexFaces().size(), color_seed + mesh);
+        } else {
+            material.diffuse = loadTexture(file_name, "_diffuse.tga");
+        }
+        if (shading == "phong" || shading == "normalmap") {
+            material.specular = loadTexture(file_name, "_spec.tga");
+        }
+        if (shading == "normalmap") {
+            material.normal_map = loadTexture(file_name, "_nm_tangent.tga");
+        }
+    }
 
-    for (const auto& face : faces) {
-        Vec4 clip[3];
-        Vec3 v0 = vertices[std::get<0>(face)];
-        Vec3 v1 = vertices[std::get<1>(face)];
-        Vec3 v2 = vertices[std::get<2>(face)];
+    // With an output (- for stdout) the frames are streamed there as raw bgr24 pixels
+    // instead of being written to TGA files
+    std::optional<FrameStream> stream;
+    if (argc > 5) {
+#ifdef SIGPIPE
+        // An encoder quitting early must fail the next write rather than end the process
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        stream.emplace(argv[5]);
+        if (!stream->isOpen()) {
+            return 1;
+        }
+    }
+    FrameWriter writer = stream ? FrameWriter(*stream, width, height, TGAImage::RGB) : FrameWriter(width, height, TGAImage::RGB);
+    std::variant<RenderTarget<BGR8>, RenderTarget<BGR8, 2>, RenderTarget<BGR8, 4>, RenderTarget<BGR8, 8>> targets;
+    switch (samples) {
+    case 2:
+        targets.emplace<1>(width, height);
+        break;
+    case 4:
+        targets.emplace<2>(width, height);
+        break;
+    case 8:
+        targets.emplace<3>(width, height);
+        break;
+    default:
+        targets.emplace<0>(width, height);
+    }
+    std::optional<DeferredRenderer<BGR8>> renderer;
+    if (deferred) {
+        renderer.emplace(width, height);
+    }
+    ClipBuffer clip;
+    std::vector<int> visible, visible_meshlets, meshlet_vertices;
+    // Faces of the visible meshlets of every instance drawn in a frame, as the deferred
+    // renderer reads them until shade()
+    std::vector<std::vector<Face>> draw_faces;
+    std::vector<std::vector<int>> draw_face_ids;
+    for (std::size_t i = 0; i < poses.size(); ++i) {
+        const CameraPose& pose = poses[i];
+        lookAt(pose.eye, pose.center, pose.up);
+        perspective(pose.focal);
+        viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8); // build the Viewport matrix
+        const Matrix<4, 4> view = Modelview;
+        const Matrix<4, 4> view_projection = Perspective * view;
 
-        auto composed_matrix = Perspective * Modelview;
+        TGAImage framebuffer = writer.acquire();
+        std::visit([&](auto& target) {
+            using Target = std::decay_t<decltype(target)>;
+            target.clear();
+            if (renderer) {
+                renderer->clear();
+            }
+            // Instances outside the view are dropped before any of their vertices is touched
+            scene.cull(view_projection, width, height, visible);
+            draw_faces.resize(std::max(draw_faces.size(), visible.size()));
+            draw_face_ids.resize(draw_faces.size());
+            for (std::size_t n = 0; n < visible.size(); ++n) {
+                const Instance& instance = scene.getInstances()[visible[n]];
+                // Far instances are drawn with fewer faces, from a simplified mesh
+                const int lod = lod_pixels >= 0 ? scene.selectLod(visible[n], view_projection, lod_pixels) : 0;
+                const Model& model = scene.getMesh(instance.mesh, lod);
+                const MeshMaterial& material = materials[instance.mesh];
+                Modelview = view * instance.transform;
+                // So are the meshlets outside the view or facing away
+                const Meshlets& meshlets = scene.getMeshlets(instance.mesh, lod);
+                meshlets.cull(Perspective * Modelview, width, height, visible_meshlets);
+                const std::vector<Face>& faces = draw_faces[n];
+                const std::vector<int>& face_ids = draw_face_ids[n];
+                meshlets.gather(visible_meshlets, meshlet_vertices, draw_faces[n], draw_face_ids[n]);
+                transformVertices(Perspective * Modelview, model.getVertices(), meshlet_vertices, clip);
 
-        clip[0] = composed_matrix * Vec4{v0.x, v0.y, v0.z, 1.};
-        clip[1] = composed_matrix * Vec4{v1.x, v1.y, v1.z, 1.};
-        clip[2] = composed_matrix * Vec4{v2.x, v2.y, v2.z, 1.};
+                // The shaders capture Modelview when they are constructed and carry the light
+                // through it, so it is given in the object space of the instance
+                const Vec3 object_light = (instance.transform.Inverti() * Vec4{light.x, light.y, light.z, 0}).xyz();
+                const auto render = [&](const auto& shader) {
+                    const FaceSubsetShader subset{shader, face_ids};
+                    if (renderer) {
+                        renderer->draw(subset, clip, faces);
+                    } else {
+                        draw(subset, clip, faces, target);
+                    }
+                };
+                const auto submit = [&](const auto& shader) {
+                    if (shadow) {
+                        render(ShadowedShader{shader, *shadow, shadow->viewProjection() * instance.transform});
+                    } else {
+                        render(shader);
+                    }
+                };
+                if (shading == "flat") {
+                    submit(FlatShader{model, object_light, material.colors});
+                } else if (shading == "gouraud") {
+                    submit(GouraudShader{model, object_light, material.diffuse});
+                } else if (shading == "phong") {
+                    submit(PhongShader{model, object_light, material.diffuse, material.specular});
+                } else {
+                    submit(NormalMapShader{model, object_light, material.diffuse, material.normal_map, material.specular});
+                }
+            }
+            if constexpr (std::is_same_v<Target, RenderTarget<BGR8>>) {
+                if (renderer) {
+                    renderer->shade(target);
+                }
+            }
+            if (post.enabled()) {
+                // The depths of a deferred frame are in the visibility buffer
+                if constexpr (std::is_same_v<Target, RenderTarget<BGR8>>) {
+                    post.apply(target, renderer ? renderer->depth() : target.depth(), framebuffer);
+                } else {
+                    post.apply(target, framebuffer);
+                }
+            } else {
+                target.resolve(framebuffer);
+            }
+        }, targets);
 
-        TGAColor rnd;
-        for (int c = 0; c < 3; c++) {
-            rnd[c] = std::rand() % 255;
+        std::string output = "framebuffer.tga";
+        if (batch) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%04zu.tga", i);
+            output = name;
         }
-        rasterize(clip, zbuffer, framebuffer, rnd);
+        writer.submit(std::move(framebuffer), std::move(output));
+        // Everything the frame allocated from the frame arenas is freed at once
+        resetFrameArenas();
     }
-
-    framebuffer.write_tga_file("framebuffer.tga");
-    return 0;
+    const bool written = writer.finish();
+    if constexpr (profile::Enabled) {
+        profile::writeSummary(std::cerr);
+        profile::writeTrace("trace.json");
+    }
+    return written ? 0 : 1;
 }
@@ -0,0 +1,102 @@
+#include "mapped_file.h"
+
+#include <fstream>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINYRENDERER_MMAP
+#endif
+
+MappedFile::MappedFile(const std::string& file_name) {
+#ifdef TINYRENDERER_MMAP
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return;
+    }
+    _size = static_cast<std::size_t>(st.st_size);
+    if (_size > 0) {
+        void* addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd);
+            _size = 0;
+            return;
+        }
+        _data = static_cast<const char*>(addr);
+        _mapped = true;
+    }
+    ::close(fd);
+    _open = true;
+#else
+    std::ifstream in{file_name, std::ios::binary | std::ios::ate};
+    if (!in) {
+        return;
+    }
+    _buffer.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0);
+    if (!in.read(_buffer.data(), _buffer.size())) {
+        _buffer.clear();
+        return;
+    }
+    _data = _buffer.data();
+    _size = _buffer.size();
+    _open = true;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        _open = std::exchange(other._open, false);
+        _mapped = std::exchange(other._mapped, false);
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+        _buffer = std::move(other._buffer);
+    }
+    return *this;
+}
+
+bool MappedFile::isOpen() const {
+    return _open;
+}
+
+const char* MappedFile::data() const {
+    return _data;
+}
+
+std::size_t MappedFile::size() const {
+    return _size;
+}
+
+std::string_view MappedFile::view() const {
+    return {_data, _size};
+}
+
+void MappedFile::close() {
+#ifdef TINYRENDERER_MMAP
+    if (_mapped) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+    _open = false;
+    _mapped = false;
+    _data = nullptr;
+    _size = 0;
+    _buffer.clear();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only view of a whole file. The file is memory-mapped on POSIX systems and read
+// into memory elsewhere, so callers never copy or stream it themselves.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& file_name);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool isOpen() const;
+    const char* data() const;
+    std::size_t size() const;
+    std::string_view view() const;
+
+private:
+    void close();
+
+    bool _open = false;
+    bool _mapped = false;
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+    std::vector<char> _buffer;
+};
@@ -3,30 +3,31 @@
 
 #include <cassert>
 #include <iostream>
+#include <type_traits>
 
 // Forward declaration for determinant helper
-template <int N>
+template <int N, typename T>
 struct DeterminantHelper;
 
-template <int NRows, int NCols>
+template <int NRows, int NCols, typename T = Real>
 struct Matrix {
-    Vector<NCols> rows[NRows] = {};
+    Vector<NCols, T> rows[NRows] = {};
 
-    Vector<NCols>& operator[](const int idx) {
+    Vector<NCols, T>& operator[](const int idx) {
         assert(idx >= 0 && idx < NRows);
         return rows[idx];
     }
-    const Vector<NCols>& operator[](const int idx) const {
+    const Vector<NCols, T>& operator[](const int idx) const {
         assert(idx >= 0 && idx < NRows);
         return rows[idx];
     }
 
-    double det() const {
-        return DeterminantHelper<NCols>::det(*this);
+    T det() const {
+        return DeterminantHelper<NCols, T>::det(*this);
     }
 
-    double cofactor(const int row, const int col) const {
-        Matrix<NRows - 1, NCols - 1> submatrix;
+    T cofactor(const int row, const int col) const {
+        Matrix<NRows - 1, NCols - 1, T> submatrix;
         for (int i = 0, si = 0; i < NRows; ++i) {
             if (i == row)
                 continue;
@@ -41,8 +42,8 @@ struct Matrix {
         return submatrix.det() * ((row + col) % 2 ? -1 : 1);
     }
 
-    Matrix<NRows, NCols> invertTranspose() const {
-        Matrix<NRows, NCols> adjugate_transpose;
+    Matrix<NRows, NCols, T> invertTranspose() const {
+        Matrix<NRows, NCols, T> adjugate_transpose;
         for (int i = 0; i < NRows; ++i) {
             for (int j = 0; j < NCols; ++j) {
                 adjugate_transpose[i][j] = cofactor(i, j);
@@ -51,12 +52,12 @@ struct Matrix {
         return adjugate_transpose / (adjugate_transpose[0] * rows[0]);
     }
 
-    Matrix<NRows, NCols> Inverti() const {
+    Matrix<NRows, NCols, T> Inverti() const {
         return invertTranspose().transpose();
     }
 
-    Matrix<NCols, NRows> transpose() const {
-        Matrix<NCols, NRows> ret;
+    Matrix<NCols, NRows, T> transpose() const {
+        Matrix<NCols, NRows, T> ret;
         for (int i = 0; i < NCols; ++i) {
             for (int j = 0; j < NRows; ++j) {
                 ret[i][j] = rows[j][i];
@@ -66,25 +67,25 @@ struct Matrix {
     }
 };
 
-template <int NRows, int NCols>
-Vector<NCols> operator*(const Vector<NRows>& lhs, const Matrix<NRows, NCols>& rhs) {
-    Matrix<1, NRows> temp;
+template <int NRows, int NCols, typename T>
+Vector<NCols, T> operator*(const Vector<NRows, T>& lhs, const Matrix<NRows, NCols, T>& rhs) {
+    Matrix<1, NRows, T> temp;
     temp[0] = lhs;
     return (temp * rhs)[0];
 }
 
-template <int NRows, int NCols>
-Vector<NRows> operator*(const Matrix<NRows, NCols>& lhs, const Vector<NCols>& rhs) {
-    Vector<NRows> ret;
+template <int NRows, int NCols, typename T>
+Vector<NRows, T> operator*(const Matrix<NRows, NCols, T>& lhs, const Vector<NCols, T>& rhs) {
+    Vector<NRows, T> ret;
     for (int i = 0; i < NRows; ++i) {
         ret[i] = lhs[i] * rhs;
     }
     return ret;
 }
 
-template <int R1, int C1, int C2>
-Matrix<R1, C2> operator*(const Matrix<R1, C1>& lhs, const Matrix<C1, C2>& rhs) {
-    Matrix<R1, C2> result;
+template <int R1, int C1, int C2, typename T>
+Matrix<R1, C2, T> operator*(const Matrix<R1, C1, T>& lhs, const Matrix<C1, C2, T>& rhs) {
+    Matrix<R1, C2, T> result;
     for (int i = 0; i < R1; ++i) {
         for (int j = 0; j < C2; ++j) {
             result[i][j] = 0;
@@ -96,27 +97,27 @@ Matrix<R1, C2> operator*(const Matrix<R1, C1>& lhs, const Matrix<C1, C2>& rhs) {
     return result;
 }
 
-template <int NRows, int NCols>
-Matrix<NRows, NCols> operator*(const Matrix<NRows, NCols>& lhs, const double& val) {
-    Matrix<NRows, NCols> result;
+template <int NRows, int NCols, typename T>
+Matrix<NRows, NCols, T> operator*(const Matrix<NRows, NCols, T>& lhs, const std::type_identity_t<T>& val) {
+    Matrix<NRows, NCols, T> result;
     for (int i = 0; i < NRows; ++i) {
         result[i] = lhs[i] * val;
     }
     return result;
 }
 
-template <int NRows, int NCols>
-Matrix<NRows, NCols> operator/(const Matrix<NRows, NCols>& lhs, const double& val) {
-    Matrix<NRows, NCols> result;
+template <int NRows, int NCols, typename T>
+Matrix<NRows, NCols, T> operator/(const Matrix<NRows, NCols, T>& lhs, const std::type_identity_t<T>& val) {
+    Matrix<NRows, NCols, T> result;
     for (int i = 0; i < NRows; ++i) {
         result[i] = lhs[i] / val;
     }
     return result;
 }
 
-template <int NRows, int NCols>
-Matrix<NRows, NCols> operator+(const Matrix<NRows, NCols>& lhs, const Matrix<NRows, NCols>& rhs) {
-    Matrix<NRows, NCols> result;
+template <int NRows, int NCols, typename T>
+Matrix<NRows, NCols, T> operator+(const Matrix<NRows, NCols, T>& lhs, const Matrix<NRows, NCols, T>& rhs) {
+    Matrix<NRows, NCols, T> result;
     for (int i = 0; i < NRows; ++i) {
         for (int j = 0; j < NCols; ++j) {
             result[i][j] = lhs[i][j] + rhs[i][j];
@@ -125,9 +126,9 @@ Matrix<NRows, NCols> operator+(const Matrix<NRows, NCols>& lhs, const Matrix<NRo
     return result;
 }
 
-template <int NRows, int NCols>
-Matrix<NRows, NCols> operator-(const Matrix<NRows, NCols>& lhs, const Matrix<NRows, NCols>& rhs) {
-    Matrix<NRows, NCols> result;
+template <int NRows, int NCols, typename T>
+Matrix<NRows, NCols, T> operator-(const Matrix<NRows, NCols, T>& lhs, const Matrix<NRows, NCols, T>& rhs) {
+    Matrix<NRows, NCols, T> result;
     for (int i = 0; i < NRows; ++i) {
         for (int j = 0; j < NCols; ++j) {
             result[i][j] = lhs[i][j] - rhs[i][j];
@@ -136,8 +137,8 @@ Matrix<NRows, NCols> operator-(const Matrix<NRows, NCols>& lhs, const Matrix<NRo
     return result;
 }
 
-template <int NRows, int NCols>
-std::ostream& operator<<(std::ostream& out, const Matrix<NRows, NCols>& m) {
+template <int NRows, int NCols, typename T>
+std::ostream& operator<<(std::ostream& out, const Matrix<NRows, NCols, T>& m) {
     for (int i = 0; i < NRows; ++i) {
         out << m[i] << std::endl;
     }
@@ -145,10 +146,10 @@ std::ostream& operator<<(std::ostream& out, const Matrix<NRows, NCols>& m) {
 }
 
 // Determinant helper (template metaprogramming)
-template <int N>
+template <int N, typename T>
 struct DeterminantHelper {
-    static double det(const Matrix<N, N>& src) {
-        double ret = 0;
+    static T det(const Matrix<N, N, T>& src) {
+        T ret = 0;
         for (int i = 0; i < N; ++i) {
             ret += src[0][i] * src.cofactor(0, i);
         }
@@ -156,9 +157,9 @@ struct DeterminantHelper {
     }
 };
 
-template <>
-struct DeterminantHelper<1> {
-    static double det(const Matrix<1, 1>& src) {
+template <typename T>
+struct DeterminantHelper<1, T> {
+    static T det(const Matrix<1, 1, T>& src) {
         return src[0][0];
     }
 };
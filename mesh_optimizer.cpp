@@ -0,0 +1,484 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+// Weight of the planes along borders and seams, perpendicular to the faces, relative to
+// the area weight of the face planes: it keeps those edges where they are
+constexpr Real SeamWeight = 10;
+
+// Value of an attribute map for an attribute with no entry, -1 meaning "none"
+constexpr int Unmapped = -2;
+
+// Sum of the weighted squared distances to a set of planes, and of their weights
+struct Quadric {
+    Real a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    Real b0 = 0, b1 = 0, b2 = 0;
+    Real c = 0;
+    Real weight = 0;
+
+    // Adds the plane n . p + d = 0, with a unit normal n
+    void addPlane(const Vec3& n, const Real d, const Real w) {
+        a00 += w * n.x * n.x;
+        a01 += w * n.x * n.y;
+        a02 += w * n.x * n.z;
+        a11 += w * n.y * n.y;
+        a12 += w * n.y * n.z;
+        a22 += w * n.z * n.z;
+        b0 += w * n.x * d;
+        b1 += w * n.y * d;
+        b2 += w * n.z * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00;
+        a01 += q.a01;
+        a02 += q.a02;
+        a11 += q.a11;
+        a12 += q.a12;
+        a22 += q.a22;
+        b0 += q.b0;
+        b1 += q.b1;
+        b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    Real error(const Vec3& p) const {
+        const Real e = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z + 2 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z) +
+                       2 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+        return weight > 0 ? std::max(e, Real{0}) / weight : 0;
+    }
+};
+
+int cornerOf(const Face& face, const int v) {
+    return face[0] == v ? 0 : face[1] == v ? 1 : face[2] == v ? 2 : -1;
+}
+
+// Maps of one attribute index to another, small enough for a linear search
+using AttributeMap = std::vector<std::pair<int, int>>;
+
+// Adds from -> to, false if from already maps to something else
+bool addMapping(AttributeMap& map, const int from, const int to) {
+    for (const auto& [key, value] : map) {
+        if (key == from) {
+            return value == to;
+        }
+    }
+    map.emplace_back(from, to);
+    return true;
+}
+
+int mapped(const AttributeMap& map, const int from) {
+    for (const auto& [key, value] : map) {
+        if (key == from) {
+            return value;
+        }
+    }
+    return Unmapped;
+}
+
+// Half-edge collapses over a mesh whose faces index welded vertices (vertex_ids), with the
+// per-corner vertex, texture coordinate and normal indices as three attributes
+class EdgeCollapser {
+public:
+    EdgeCollapser(std::span<const Vec3> vertices, std::span<const int> vertex_ids, const std::array<std::vector<Face>*, 3>& attributes)
+        : _vertices(vertices), _attributes(attributes) {
+        const std::vector<Face>& vertex_faces = *attributes[0];
+        const std::size_t num_faces = vertex_faces.size();
+        _faces.resize(num_faces);
+        _alive.assign(num_faces, true);
+        _incident.resize(vertices.size());
+        _quadrics.resize(vertices.size());
+        _aliveCount = num_faces;
+        for (std::size_t f = 0; f < num_faces; ++f) {
+            Face& face = _faces[f];
+            for (int k = 0; k < 3; ++k) {
+                face[k] = vertex_ids[vertex_faces[f][k]];
+            }
+            if (face[0] == face[1] || face[1] == face[2] || face[2] == face[0]) {
+                _alive[f] = false;
+                --_aliveCount;
+                continue;
+            }
+            const Vec3 n = normal(face);
+            const Real length = norm(n);
+            for (const int v : face) {
+                _incident[v].push_back(static_cast<int>(f));
+                if (length > 0) {
+                    _quadrics[v].addPlane(n / length, -(n * _vertices[face[0]]) / length, length / 2);
+                }
+            }
+        }
+
+        // Edges with a single face are borders, and those whose faces differ in an attribute
+        // at either end are seams. Both get a plane through the edge across its face.
+        std::vector<std::array<int, 3>> half_edges; // lower vertex, higher vertex, face
+        for (std::size_t f = 0; f < num_faces; ++f) {
+            if (_alive[f]) {
+                for (int k = 0; k < 3; ++k) {
+                    const auto [a, b] = std::minmax(_faces[f][k], _faces[f][(k + 1) % 3]);
+                    half_edges.push_back({a, b, static_cast<int>(f)});
+                }
+            }
+        }
+        std::sort(half_edges.begin(), half_edges.end());
+        for (std::size_t begin = 0, end = 0; begin < half_edges.size(); begin = end) {
+            while (end < half_edges.size() && half_edges[end][0] == half_edges[begin][0] && half_edges[end][1] == half_edges[begin][1]) {
+                ++end;
+            }
+            bool seam = end - begin != 2;
+            if (!seam) {
+                const int f0 = half_edges[begin][2], f1 = half_edges[begin + 1][2];
+                for (const int v : {half_edges[begin][0], half_edges[begin][1]}) {
+                    const int k0 = cornerOf(_faces[f0], v), k1 = cornerOf(_faces[f1], v);
+                    for (const std::vector<Face>* faces : _attributes) {
+                        seam = seam || (*faces)[f0][k0] != (*faces)[f1][k1];
+                    }
+                }
+            }
+            if (seam) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    const auto [a, b, f] = half_edges[i];
+                    const Vec3 edge = _vertices[b] - _vertices[a];
+                    const Vec3 face_normal = normal(_faces[f]);
+                    const Vec3 n = cross(edge, face_normal);
+                    const Real length = norm(n);
+                    if (length > 0) {
+                        const Real w = (edge * edge) * SeamWeight;
+                        _quadrics[a].addPlane(n / length, -(n * _vertices[a]) / length, w);
+                        _quadrics[b].addPlane(n / length, -(n * _vertices[a]) / length, w);
+                    }
+                }
+            }
+        }
+    }
+
+    std::size_t aliveCount() const {
+        return _aliveCount;
+    }
+    std::span<const Face> getFaces() const {
+        return _faces;
+    }
+    bool isAlive(const std::size_t face) const {
+        return _alive[face];
+    }
+
+    // Mean squared distance of the position of vertex to to the planes of both vertices
+    Real error(const int from, const int to) const {
+        Quadric q = _quadrics[from];
+        q.add(_quadrics[to]);
+        return q.error(_vertices[to]);
+    }
+
+    // Whether vertex from may move onto vertex to. Leaves the attribute maps of the
+    // collapse for collapse().
+    bool allowed(const int from, const int to) {
+        for (AttributeMap& map : _maps) {
+            map.clear();
+        }
+        // The faces with both vertices go, and give the attributes of the others'
+        // corners at from on the same side of a seam their values at to
+        int shared = 0;
+        for (const int f : _incident[from]) {
+            const int j = cornerOf(_faces[f], to);
+            if (_alive[f] && j >= 0) {
+                ++shared;
+                const int k = cornerOf(_faces[f], from);
+                for (int a = 0; a < 3; ++a) {
+                    if (!addMapping(_maps[a], (*_attributes[a])[f][k], (*_attributes[a])[f][j])) {
+                        return false;
+                    }
+                }
+            }
+        }
+        for (const int f : _incident[from]) {
+            if (!_alive[f] || cornerOf(_faces[f], to) >= 0) {
+                continue;
+            }
+            const int k = cornerOf(_faces[f], from);
+            for (int a = 0; a < 3; ++a) {
+                if (mapped(_maps[a], (*_attributes[a])[f][k]) == Unmapped) {
+                    return false;
+                }
+            }
+            Face moved = _faces[f];
+            moved[k] = to;
+            if (normal(moved) * normal(_faces[f]) <= 0) {
+                return false;
+            }
+        }
+
+        // A vertex on a border only moves along it, and the two vertices may share no
+        // neighbour but the third corners of their shared faces
+        neighbours(from, _fromNeighbours);
+        bool border = false;
+        for (std::size_t i = 0; i < _fromNeighbours.size(); ++i) {
+            const bool repeated = (i > 0 && _fromNeighbours[i - 1] == _fromNeighbours[i]) ||
+                                  (i + 1 < _fromNeighbours.size() && _fromNeighbours[i + 1] == _fromNeighbours[i]);
+            border = border || !repeated;
+        }
+        if (shared != (border ? 1 : 2)) {
+            return false;
+        }
+        neighbours(to, _toNeighbours);
+        _fromNeighbours.erase(std::unique(_fromNeighbours.begin(), _fromNeighbours.end()), _fromNeighbours.end());
+        _toNeighbours.erase(std::unique(_toNeighbours.begin(), _toNeighbours.end()), _toNeighbours.end());
+        _common.clear();
+        std::set_intersection(_fromNeighbours.begin(), _fromNeighbours.end(), _toNeighbours.begin(), _toNeighbours.end(),
+                              std::back_inserter(_common));
+        return static_cast<int>(_common.size()) == shared;
+    }
+
+    // Moves vertex from onto vertex to, right after allowed(from, to)
+    void collapse(const int from, const int to) {
+        for (const int f : _incident[from]) {
+            if (!_alive[f]) {
+                continue;
+            }
+            if (cornerOf(_faces[f], to) >= 0) {
+                _alive[f] = false;
+                --_aliveCount;
+                continue;
+            }
+            const int k = cornerOf(_faces[f], from);
+            _faces[f][k] = to;
+            for (int a = 0; a < 3; ++a) {
+                int& attribute = (*_attributes[a])[f][k];
+                attribute = mapped(_maps[a], attribute);
+            }
+            _incident[to].push_back(f);
+        }
+        _incident[from].clear();
+        std::erase_if(_incident[to], [&](const int f) { return !_alive[f]; });
+        _quadrics[to].add(_quadrics[from]);
+    }
+
+private:
+    Vec3 normal(const Face& face) const {
+        const Vec3& p0 = _vertices[face[0]];
+        return cross(_vertices[face[1]] - p0, _vertices[face[2]] - p0);
+    }
+
+    // The other corners of the faces around v, sorted, twice for an edge with two faces
+    void neighbours(const int v, std::vector<int>& result) const {
+        result.clear();
+        for (const int f : _incident[v]) {
+            if (_alive[f]) {
+                for (const int u : _faces[f]) {
+                    if (u != v) {
+                        result.push_back(u);
+                    }
+                }
+            }
+        }
+        std::sort(result.begin(), result.end());
+    }
+
+    std::span<const Vec3> _vertices;
+    std::array<std::vector<Face>*, 3> _attributes;
+    std::vector<Face> _faces; // welded vertex indices
+    std::vector<bool> _alive;
+    std::size_t _aliveCount = 0;
+    std::vector<std::vector<int>> _incident; // faces around every welded vertex, some dead
+    std::vector<Quadric> _quadrics;
+    std::array<AttributeMap, 3> _maps;
+    std::vector<int> _fromNeighbours, _toNeighbours, _common;
+};
+
+}
+
+std::vector<int> optimizeTriangleOrder(const std::span<const Face> faces, const int vertex_count, const int cache_size) {
+    // Faces around every vertex, those of vertex v at adjacency[offsets[v], offsets[v + 1])
+    std::vector<int> offsets(vertex_count + 1, 0);
+    for (const Face& face : faces) {
+        for (const int v : face) {
+            ++offsets[v + 1];
+        }
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<int> adjacency(offsets.back());
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (std::size_t f = 0; f < faces.size(); ++f) {
+        for (const int v : faces[f]) {
+            adjacency[next[v]++] = static_cast<int>(f);
+        }
+    }
+
+    // live: faces of a vertex not emitted yet. cached: time the vertex last entered the
+    // cache, which holds it while time - cached <= cache_size.
+    std::vector<int> live(vertex_count);
+    for (int v = 0; v < vertex_count; ++v) {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+    std::vector<int> cached(vertex_count, 0);
+    std::vector<bool> emitted(faces.size(), false);
+    std::vector<int> dead_ends, candidates, order;
+    order.reserve(faces.size());
+    int time = cache_size + 1;
+    int cursor = 0;
+    int fan = faces.empty() ? -1 : faces[0][0];
+    while (fan >= 0) {
+        candidates.clear();
+        for (int i = offsets[fan]; i < offsets[fan + 1]; ++i) {
+            const int f = adjacency[i];
+            if (emitted[f]) {
+                continue;
+            }
+            emitted[f] = true;
+            order.push_back(f);
+            for (const int v : faces[f]) {
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cached[v] > cache_size) {
+                    cached[v] = time++;
+                }
+            }
+        }
+
+        // The next fan is around the vertex just emitted which has been in the cache the
+        // longest, among those whose remaining faces still fit before it is evicted
+        fan = -1;
+        int best = -1;
+        for (const int v : candidates) {
+            if (live[v] > 0) {
+                const int priority = time - cached[v] + 2 * live[v] <= cache_size ? time - cached[v] : 0;
+                if (priority > best) {
+                    best = priority;
+                    fan = v;
+                }
+            }
+        }
+        // Otherwise a recent vertex with faces left, or the next one in index order
+        while (fan < 0 && !dead_ends.empty()) {
+            if (live[dead_ends.back()] > 0) {
+                fan = dead_ends.back();
+            }
+            dead_ends.pop_back();
+        }
+        for (; fan < 0 && cursor < vertex_count; ++cursor) {
+            if (live[cursor] > 0) {
+                fan = cursor;
+            }
+        }
+    }
+    return order;
+}
+
+std::vector<int> optimizeVertexOrder(const std::span<const Face> faces, const int vertex_count) {
+    std::vector<int> remap(vertex_count, -1);
+    int count = 0;
+    for (const Face& face : faces) {
+        for (const int v : face) {
+            if (remap[v] < 0) {
+                remap[v] = count++;
+            }
+        }
+    }
+    return remap;
+}
+
+double acmr(const std::span<const Face> faces, const int cache_size) {
+    if (faces.empty()) {
+        return 0;
+    }
+    std::vector<int> fifo(cache_size, -1);
+    std::size_t head = 0, misses = 0;
+    for (const Face& face : faces) {
+        for (const int v : face) {
+            if (std::find(fifo.begin(), fifo.end(), v) == fifo.end()) {
+                fifo[head] = v;
+                head = (head + 1) % fifo.size();
+                ++misses;
+            }
+        }
+    }
+    return static_cast<double>(misses) / faces.size();
+}
+
+std::vector<SimplifiedFaces> simplifyFaces(const std::span<const Vec3> vertices, const std::span<const int> vertex_ids,
+                                           const std::span<const Face> vertex_faces, const std::span<const Face> uv_faces,
+                                           const std::span<const Face> normal_faces, const std::span<const std::size_t> target_faces) {
+    std::array<std::vector<Face>, 3> corners = {std::vector<Face>(vertex_faces.begin(), vertex_faces.end()),
+                                                std::vector<Face>(uv_faces.begin(), uv_faces.end()),
+                                                std::vector<Face>(normal_faces.begin(), normal_faces.end())};
+    EdgeCollapser collapser(vertices, vertex_ids, {&corners[0], &corners[1], &corners[2]});
+    struct Collapse {
+        Real error;
+        int from, to;
+    };
+    std::vector<std::pair<int, int>> edges;
+    std::vector<Collapse> collapses;
+    std::vector<bool> locked(vertices.size());
+    Real max_error = 0;
+    std::vector<SimplifiedFaces> levels;
+    for (const std::size_t target : target_faces) {
+        // Every pass collapses the cheapest edges first, each vertex at most once, since
+        // its neighbours' errors change with it
+        for (bool collapsed = true; collapsed && collapser.aliveCount() > target;) {
+            edges.clear();
+            const std::span<const Face> faces = collapser.getFaces();
+            for (std::size_t f = 0; f < faces.size(); ++f) {
+                if (collapser.isAlive(f)) {
+                    for (int k = 0; k < 3; ++k) {
+                        edges.push_back(std::minmax(faces[f][k], faces[f][(k + 1) % 3]));
+                    }
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+            collapses.clear();
+            for (const auto& [a, b] : edges) {
+                collapses.push_back({collapser.error(a, b), a, b});
+                collapses.push_back({collapser.error(b, a), b, a});
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& c1, const Collapse& c2) { return c1.error < c2.error; });
+
+            // Only the cheapest allowed collapses, as many as a quarter of the edges, are
+            // tried, the others are evaluated again next pass. Those touching either vertex
+            // of a collapse wait too, as its quadric has changed; the errors of the others
+            // only depend on the quadrics of their own vertices, and allowed() checks the
+            // faces around them as they are now.
+            std::fill(locked.begin(), locked.end(), false);
+            collapsed = false;
+            std::size_t tried = 0;
+            for (std::size_t i = 0; i < collapses.size() && tried * 4 < edges.size() && collapser.aliveCount() > target; ++i) {
+                const Collapse& c = collapses[i];
+                if (locked[c.from] || locked[c.to]) {
+                    ++tried;
+                    continue;
+                }
+                if (!collapser.allowed(c.from, c.to)) {
+                    continue;
+                }
+                ++tried;
+                collapser.collapse(c.from, c.to);
+                locked[c.from] = locked[c.to] = true;
+                max_error = std::max(max_error, c.error);
+                collapsed = true;
+            }
+        }
+
+        SimplifiedFaces& level = levels.emplace_back();
+        for (std::size_t f = 0; f < vertex_faces.size(); ++f) {
+            if (collapser.isAlive(f)) {
+                level.vertex_faces.push_back(corners[0][f]);
+                level.uv_faces.push_back(corners[1][f]);
+                level.normal_faces.push_back(corners[2][f]);
+            }
+        }
+        level.error = std::sqrt(max_error);
+    }
+    return levels;
+}
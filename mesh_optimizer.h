@@ -0,0 +1,49 @@
+#pragma once
+
+#include "model.h"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Entries of the FIFO post-transform vertex cache the triangle order is tuned for, and
+// the ACMR is measured with
+constexpr int VertexCacheSize = 16;
+
+// Order of faces (indices into faces) which reuses vertices while they are still in a
+// cache of cache_size entries: Tipsify (Sander, Nehab and Barczak, "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw", 2007), which fans around a vertex
+// at a time and runs in time linear in the number of faces. Vertex indices are below
+// vertex_count.
+std::vector<int> optimizeTriangleOrder(std::span<const Face> faces, const int vertex_count, const int cache_size = VertexCacheSize);
+
+// New index of every vertex, by first use in faces so they are fetched in increasing
+// order, -1 for the vertices no face uses
+std::vector<int> optimizeVertexOrder(std::span<const Face> faces, const int vertex_count);
+
+// Average cache miss ratio: vertices a FIFO cache of cache_size entries misses per
+// face, from 3 without reuse down to about 0.5 for a regular grid
+double acmr(std::span<const Face> faces, const int cache_size = VertexCacheSize);
+
+// Faces of a mesh simplified by simplifyFaces(), into the attribute arrays of the original
+// mesh, and the error of the simplification
+struct SimplifiedFaces {
+    std::vector<Face> vertex_faces;
+    std::vector<Face> uv_faces;
+    std::vector<Face> normal_faces;
+    Real error = 0;
+};
+
+// Simplifies a mesh by edge collapses in the order of their quadric error (Garland and
+// Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997) down to each of
+// target_faces in turn, decreasing, or until no edge can collapse, and returns the faces
+// left at each. Vertices move onto a neighbour, so the attribute arrays stay as they are.
+// vertex_ids maps every vertex to one with the same position, so that corners split for
+// texture coordinates or normals still connect. Collapses which would flip a face, pinch
+// the surface, or move a border or a seam, where the vertices, texture coordinates or
+// normals of the faces on either side of an edge differ, are not made. The error is the
+// largest root mean square distance of a moved vertex to the planes of the faces merged
+// into it.
+std::vector<SimplifiedFaces> simplifyFaces(std::span<const Vec3> vertices, std::span<const int> vertex_ids, std::span<const Face> vertex_faces,
+                                           std::span<const Face> uv_faces, std::span<const Face> normal_faces,
+                                           std::span<const std::size_t> target_faces);
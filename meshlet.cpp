@@ -0,0 +1,208 @@
+#include "meshlet.h"
+
+#include "aabb.h"
+#include "gl.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Cosine of the largest angle between the normal of a face and the mean normal of the
+// meshlet it joins. Wider meshlets hold more faces but are rarely back-facing as a
+// whole: on african_head 45 degrees culls about twice the faces no limit does.
+constexpr Real MinAxisCos = Real{0.7};
+
+}
+
+Meshlets::Meshlets(const Model& model) {
+    const std::span<const Vec3> positions = model.getVertices();
+    const std::span<const Face> faces = model.getVertexFaces();
+    const int num_vertices = static_cast<int>(positions.size());
+    const int num_faces = static_cast<int>(faces.size());
+
+    // Faces around every vertex, those of vertex v at adjacency[offsets[v], offsets[v + 1])
+    std::vector<int> offsets(num_vertices + 1, 0);
+    for (const Face& face : faces) {
+        for (const int v : face) {
+            ++offsets[v + 1];
+        }
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<int> adjacency(offsets.back());
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (int f = 0; f < num_faces; ++f) {
+        for (const int v : faces[f]) {
+            adjacency[next[v]++] = f;
+        }
+    }
+    // Unit normals, zero for degenerate faces, which have no orientation to cull by
+    std::vector<Vec3> normals(num_faces);
+    for (int f = 0; f < num_faces; ++f) {
+        const Vec3& p0 = positions[faces[f][0]];
+        const Vec3 n = cross(positions[faces[f][1]] - p0, positions[faces[f][2]] - p0);
+        const Real length = norm(n);
+        normals[f] = length > 0 ? n / length : Vec3{};
+    }
+
+    std::vector<bool> used(num_faces, false);
+    std::vector<int> local(num_vertices, -1); // index of a vertex in the current meshlet
+    std::vector<int> candidates;
+    for (int cursor = 0;;) {
+        // A meshlet starts next to the previous one, or else at the first face left
+        int seed = -1;
+        for (std::size_t i = 0; i < candidates.size() && seed < 0; ++i) {
+            if (!used[candidates[i]]) {
+                seed = candidates[i];
+            }
+        }
+        for (; seed < 0 && cursor < num_faces; ++cursor) {
+            if (!used[cursor]) {
+                seed = cursor;
+            }
+        }
+        if (seed < 0) {
+            break;
+        }
+        Meshlet meshlet;
+        meshlet.first_vertex = static_cast<int>(_vertices.size());
+        meshlet.first_face = static_cast<int>(_faces.size());
+        Vec3 normal_sum;
+        candidates.clear();
+        for (int f = seed; f >= 0;) {
+            used[f] = true;
+            std::array<std::uint8_t, 3> corners;
+            for (int k = 0; k < 3; ++k) {
+                const int v = faces[f][k];
+                if (local[v] < 0) {
+                    local[v] = meshlet.vertex_count++;
+                    _vertices.push_back(v);
+                    candidates.insert(candidates.end(), adjacency.begin() + offsets[v], adjacency.begin() + offsets[v + 1]);
+                }
+                corners[k] = static_cast<std::uint8_t>(local[v]);
+            }
+            _faces.push_back(corners);
+            _faceIds.push_back(f);
+            normal_sum = normal_sum + normals[f];
+            if (++meshlet.face_count == MaxFaces) {
+                break;
+            }
+
+            // The next face shares vertices with the meshlet and adds the fewest, then
+            // faces the way of the meshlet the most. Faces turned too far from it are left
+            // to another meshlet, so its cone stays narrow enough to cull.
+            std::erase_if(candidates, [&](const int c) { return used[c]; });
+            f = -1;
+            int fewest = 4;
+            Real alignment = std::numeric_limits<Real>::lowest();
+            const Real min_alignment = MinAxisCos * norm(normal_sum);
+            for (const int c : candidates) {
+                const int added = (local[faces[c][0]] < 0) + (local[faces[c][1]] < 0) + (local[faces[c][2]] < 0);
+                const Real a = normals[c] * normal_sum;
+                if (a >= min_alignment && meshlet.vertex_count + added <= MaxVertices && (added < fewest || (added == fewest && a > alignment))) {
+                    f = c;
+                    fewest = added;
+                    alignment = a;
+                }
+            }
+        }
+
+        AABB bounds;
+        for (int i = meshlet.first_vertex; i < meshlet.first_vertex + meshlet.vertex_count; ++i) {
+            bounds.extend(positions[_vertices[i]]);
+            local[_vertices[i]] = -1;
+        }
+        meshlet.center = bounds.center();
+        for (int i = meshlet.first_vertex; i < meshlet.first_vertex + meshlet.vertex_count; ++i) {
+            meshlet.radius = std::max(meshlet.radius, norm(positions[_vertices[i]] - meshlet.center));
+        }
+        const Real length = norm(normal_sum);
+        if (length > 0) {
+            meshlet.cone_axis = normal_sum / length;
+            Real cone_cos = 1;
+            for (int i = meshlet.first_face; i < meshlet.first_face + meshlet.face_count; ++i) {
+                const Vec3& n = normals[_faceIds[i]];
+                if (n * n > 0) {
+                    cone_cos = std::min(cone_cos, n * meshlet.cone_axis);
+                }
+            }
+            if (cone_cos > 0) {
+                // The apex is center - axis t, with t the least putting it behind every
+                // face plane: (p - apex) . n >= 0 for a corner p and the normal n of a face
+                Real t = std::numeric_limits<Real>::lowest();
+                for (int i = meshlet.first_face; i < meshlet.first_face + meshlet.face_count; ++i) {
+                    const Vec3& n = normals[_faceIds[i]];
+                    if (n * n > 0) {
+                        const Vec3& p = positions[faces[_faceIds[i]][0]];
+                        t = std::max(t, (meshlet.center - p) * n / (meshlet.cone_axis * n));
+                    }
+                }
+                meshlet.cone_apex = meshlet.center - meshlet.cone_axis * t;
+                meshlet.cone_sin = std::sqrt(std::max(1 - cone_cos * cone_cos, Real{0}));
+            }
+        }
+        _meshlets.push_back(meshlet);
+    }
+}
+
+std::span<const Meshlet> Meshlets::getMeshlets() const {
+    return _meshlets;
+}
+
+void Meshlets::cull(const Matrix<4, 4>& transform, const int width, const int height, std::vector<int>& visible) const {
+    visible.clear();
+    Vec4 planes[FrustumPlaneCount];
+    frustumPlanes(transform, width, height, planes);
+    Real plane_norms[FrustumPlaneCount];
+    for (int i = 0; i < FrustumPlaneCount; ++i) {
+        plane_norms[i] = norm(planes[i].xyz());
+    }
+    // The eye is the point transform maps to x = y = w = 0. It is at infinity for a
+    // parallel projection, which the cone test below does not handle.
+    const Vec4 eye = transform.Inverti() * Vec4{0, 0, 1, 0};
+    const bool finite_eye = std::abs(eye.w) > std::numeric_limits<Real>::epsilon();
+    const Vec3 eye_position = finite_eye ? eye.xyz() / eye.w : Vec3{};
+
+    for (std::size_t m = 0; m < _meshlets.size(); ++m) {
+        const Meshlet& meshlet = _meshlets[m];
+        const Vec4 center{meshlet.center.x, meshlet.center.y, meshlet.center.z, 1};
+        bool outside = false;
+        for (int i = 0; i < FrustumPlaneCount && !outside; ++i) {
+            outside = planes[i] * center < -meshlet.radius * plane_norms[i];
+        }
+        if (outside) {
+            PROFILE_COUNT(MeshletsOutside, 1);
+            continue;
+        }
+        // A face is back-facing when (p - eye) . n > 0 for its points p and normal n, which
+        // is (p - apex) . n >= 0 plus (apex - eye) . n, positive for every n of the cone
+        // when apex - eye is within 90 degrees minus the cone's angle of the axis
+        if (finite_eye && meshlet.cone_sin < 1) {
+            const Vec3 v = meshlet.cone_apex - eye_position;
+            if (v * meshlet.cone_axis > meshlet.cone_sin * norm(v)) {
+                PROFILE_COUNT(MeshletsBackfacing, 1);
+                continue;
+            }
+        }
+        visible.push_back(static_cast<int>(m));
+    }
+}
+
+void Meshlets::gather(std::span<const int> visible, std::vector<int>& vertices, std::vector<Face>& faces, std::vector<int>& face_ids) const {
+    vertices.clear();
+    faces.clear();
+    face_ids.clear();
+    for (const int m : visible) {
+        const Meshlet& meshlet = _meshlets[m];
+        const int base = static_cast<int>(vertices.size());
+        vertices.insert(vertices.end(), _vertices.begin() + meshlet.first_vertex, _vertices.begin() + meshlet.first_vertex + meshlet.vertex_count);
+        for (int i = meshlet.first_face; i < meshlet.first_face + meshlet.face_count; ++i) {
+            faces.push_back({base + _faces[i][0], base + _faces[i][1], base + _faces[i][2]});
+        }
+        face_ids.insert(face_ids.end(), _faceIds.begin() + meshlet.first_face, _faceIds.begin() + meshlet.first_face + meshlet.face_count);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "matrix.h"
+#include "model.h"
+#include "vector.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// A cluster of neighbouring faces of a mesh, with the bounds to cull it as a whole
+struct Meshlet {
+    int first_vertex = 0; // into the vertices of Meshlets
+    int vertex_count = 0;
+    int first_face = 0; // into the faces of Meshlets
+    int face_count = 0;
+    // Bounding sphere of the vertices
+    Vec3 center;
+    Real radius = 0;
+    // Normal cone: every face normal is within the angle of sine cone_sin of cone_axis,
+    // and cone_apex is behind the plane of every face. The faces all face away from an eye
+    // whose direction to the apex is within 90 degrees minus that angle of the axis.
+    // Cones of 90 degrees or more never do, and have cone_sin 1.
+    Vec3 cone_axis;
+    Vec3 cone_apex;
+    Real cone_sin = 1;
+};
+
+// The faces of a Model split into meshlets of at most MaxVertices vertices and MaxFaces
+// faces, so that the faces outside the view or facing away can be dropped in bulk,
+// before their vertices are transformed. A meshlet grows from a face to the faces
+// sharing its vertices, preferring those adding the fewest vertices and then those
+// facing its way, which keeps it compact and its normal cone narrow.
+class Meshlets {
+public:
+    static constexpr int MaxVertices = 64;
+    static constexpr int MaxFaces = 124;
+
+    Meshlets() = default;
+    explicit Meshlets(const Model& model);
+
+    std::span<const Meshlet> getMeshlets() const;
+
+    // Fills visible with the indices, in increasing order, of the meshlets that are at
+    // least partly inside the view region of frustumPlanes(transform, width, height, ...)
+    // and have faces turned towards the eye of transform (from object to clip space)
+    void cull(const Matrix<4, 4>& transform, const int width, const int height, std::vector<int>& visible) const;
+    // Fills vertices with the model vertex indices of the vertices of the meshlets in
+    // visible, faces with their faces as indices into vertices and face_ids with the model
+    // face index of every face, e.g. for transformVertices() and a FaceSubsetShader
+    void gather(std::span<const int> visible, std::vector<int>& vertices, std::vector<Face>& faces, std::vector<int>& face_ids) const;
+
+private:
+    std::vector<Meshlet> _meshlets;
+    std::vector<int> _vertices;                      // model vertex indices
+    std::vector<std::array<std::uint8_t, 3>> _faces; // corners, indices into the meshlet's vertices
+    std::vector<int> _faceIds;                       // model face indices
+};
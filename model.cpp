@@ -1,100 +1,701 @@
 #include "model.h"
 
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <sstream>
+#include <memory_resource>
+#include <numeric>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINYRENDERER_MKSTEMP
+#else
+#include <random>
+#include <thread>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+// Files smaller than this are parsed on one thread, splitting them costs more than it saves
+constexpr std::size_t ParallelParseThreshold = 4 << 20;
+
+struct ObjCorner {
+    std::array<int, 3> index = {-1, -1, -1}; // position, uv, normal
+    std::array<bool, 3> relative = {false, false, false};
+};
+
+// Everything parsed from one chunk of an OBJ file. Face indices are flattened, three per
+// triangle. Relative (negative) indices can only be resolved against the element counts
+// of the chunk itself, so their positions are recorded to add the counts of the
+// preceding chunks once those are known. The arrays are only needed until they are
+// merged, so they are allocated from an arena of the chunk's own.
+struct ObjChunk {
+    explicit ObjChunk(std::pmr::memory_resource* arena)
+        : vertices(arena), uvs(arena), normals(arena), vertexIndices(arena), uvIndices(arena), normalIndices(arena),
+          vertexFixups(arena), uvFixups(arena), normalFixups(arena), polygon(arena) {
+    }
+
+    std::pmr::vector<Vec3> vertices;
+    std::pmr::vector<Vec2> uvs;
+    std::pmr::vector<Vec3> normals;
+    std::pmr::vector<int> vertexIndices;
+    std::pmr::vector<int> uvIndices;
+    std::pmr::vector<int> normalIndices;
+    std::pmr::vector<std::size_t> vertexFixups;
+    std::pmr::vector<std::size_t> uvFixups;
+    std::pmr::vector<std::size_t> normalFixups;
+    std::pmr::vector<ObjCorner> polygon; // corners of the face being parsed
+    bool malformed = false;
+};
+
+const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
+    }
+    return p;
+}
+
+// Returns the position after the parsed number, or nullptr if there is none
+template <typename T>
+const char* parseNumber(const char* p, const char* end, T& value) {
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+') {
+        ++p;
+    }
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    return ec == std::errc{} ? ptr : nullptr;
+}
+
+// OBJ indices are 1-based, or relative to the end of the list when negative. A relative
+// index is resolved against the chunk's own count here; the counts of the preceding
+// chunks are added, and the result checked, by appendFaces().
+bool resolveIndex(const int index, const std::size_t count, int& resolved, bool& relative) {
+    if (index > 0) {
+        resolved = index - 1;
+        return true;
+    }
+    if (index < 0) {
+        resolved = static_cast<int>(count) + index;
+        relative = true;
+        return true;
+    }
+    return false;
+}
+
+const char* parseCorner(const char* p, const char* end, const ObjChunk& chunk, ObjCorner& corner) {
+    const std::size_t counts[3] = {chunk.vertices.size(), chunk.uvs.size(), chunk.normals.size()};
+    for (int k = 0; k < 3; ++k) {
+        if (k > 0) {
+            if (p >= end || *p != '/') {
+                break;
+            }
+            ++p;
+            if (p < end && (*p == '/' || *p == ' ' || *p == '\t' || *p == '\r')) {
+                continue; // empty slot, as in "1//1"
+            }
+        }
+        int index = 0;
+        auto [ptr, ec] = std::from_chars(p, end, index);
+        if (ec != std::errc{} || !resolveIndex(index, counts[k], corner.index[k], corner.relative[k])) {
+            return nullptr;
+        }
+        p = ptr;
+    }
+    return p;
+}
+
+void emitCorner(ObjChunk& chunk, const ObjCorner& corner) {
+    std::pmr::vector<int>* indices[3] = {&chunk.vertexIndices, &chunk.uvIndices, &chunk.normalIndices};
+    std::pmr::vector<std::size_t>* fixups[3] = {&chunk.vertexFixups, &chunk.uvFixups, &chunk.normalFixups};
+    for (int k = 0; k < 3; ++k) {
+        if (corner.relative[k]) {
+            fixups[k]->push_back(indices[k]->size());
+        }
+        indices[k]->push_back(corner.index[k]);
+    }
+}
 
-void Model::loadVerticesFromObj(const std::string& file_name) {
-    std::ifstream model_file{"obj/" + file_name};
+// Parses the complete lines in text, which must start at the beginning of a line, into chunk
+void parseObjChunk(const std::string_view text, ObjChunk& chunk) {
+    std::pmr::vector<ObjCorner>& polygon = chunk.polygon;
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    while (p < end && !chunk.malformed) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) {
+            eol = end;
+        }
+        const char* q = skipSpaces(p, eol);
+        const std::size_t length = eol - q;
+        if (length >= 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+            Vec3& v = chunk.vertices.emplace_back();
+            q = parseNumber(q + 1, eol, v.x);
+            q = q ? parseNumber(q, eol, v.y) : nullptr;
+            q = q ? parseNumber(q, eol, v.z) : nullptr;
+            chunk.malformed = !q;
+        } else if (length >= 3 && q[0] == 'v' && q[1] == 't') {
+            Vec2& uv = chunk.uvs.emplace_back();
+            q = parseNumber(q + 2, eol, uv.x);
+            q = q ? parseNumber(q, eol, uv.y) : nullptr;
+            chunk.malformed = !q;
+        } else if (length >= 3 && q[0] == 'v' && q[1] == 'n') {
+            Vec3& n = chunk.normals.emplace_back();
+            q = parseNumber(q + 2, eol, n.x);
+            q = q ? parseNumber(q, eol, n.y) : nullptr;
+            q = q ? parseNumber(q, eol, n.z) : nullptr;
+            chunk.malformed = !q;
+        } else if (length >= 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+            polygon.clear();
+            q = skipSpaces(q + 1, eol);
+            while (q && q < eol) {
+                q = parseCorner(q, eol, chunk, polygon.emplace_back());
+                q = q ? skipSpaces(q, eol) : nullptr;
+            }
+            chunk.malformed = !q || polygon.size() < 3;
+            for (std::size_t i = 1; !chunk.malformed && i + 1 < polygon.size(); ++i) {
+                emitCorner(chunk, polygon[0]);
+                emitCorner(chunk, polygon[i]);
+                emitCorner(chunk, polygon[i + 1]);
+            }
+        }
+        p = eol + 1;
+    }
+}
 
-    if (!model_file) {
-        std::cerr << "Could not find file!\n";
-        return;
+// Splits text into about count pieces, each ending just after a newline
+std::vector<std::string_view> splitLines(const std::string_view text, const std::size_t count) {
+    std::vector<std::string_view> chunks;
+    std::size_t begin = 0;
+    for (std::size_t i = 1; i <= count && begin < text.size(); ++i) {
+        std::size_t split = text.size();
+        if (i < count) {
+            split = text.find('\n', std::max(begin, text.size() * i / count));
+            split = split == std::string_view::npos ? text.size() : split + 1;
+        }
+        chunks.push_back(text.substr(begin, split - begin));
+        begin = split;
     }
+    return chunks;
+}
+
+template <typename T>
+void append(std::vector<T>& dst, const std::pmr::vector<T>& src) {
+    dst.insert(dst.end(), src.begin(), src.end());
+}
 
-    float x, y, z;
-    char first_char;
-    while (model_file >> first_char >> x >> y >> z) {
-        if (first_char == 'v') {
-            _vertices.emplace_back(x, y, z);
-        } else {
-            return;
+// Applies the chunk's relative-index fixups, range-checks its indices and appends its
+// triangles. Only optional slots (uvs and normals) may be missing, which is -1; a
+// relative index reaching before the start of the list fails rather than reading as one.
+bool appendFaces(std::vector<Face>& faces,
+                 std::pmr::vector<int>& indices,
+                 const std::pmr::vector<std::size_t>& fixups,
+                 const int base,
+                 const std::size_t count,
+                 const bool optional) {
+    for (const std::size_t i : fixups) {
+        indices[i] += base;
+        if (indices[i] < 0) {
+            return false;
+        }
+    }
+    const int first = optional ? -1 : 0;
+    for (std::size_t i = 0; i < indices.size(); i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            if (indices[i + k] < first || indices[i + k] >= static_cast<int>(count)) {
+                return false;
+            }
         }
+        faces.push_back({indices[i], indices[i + 1], indices[i + 2]});
     }
+    return true;
 }
 
-std::pair<int, int> parseFaceIndices(const std::string& face) {
-    size_t first_slash = face.find('/');
-    size_t second_slash = face.find('/', first_slash + 1);
+// Layout of a .trmesh file: this header followed by the attribute and face arrays, in
+// the order of MeshArray, each starting at a MeshAlignment boundary. Arrays are stored
+// exactly as Model exposes them (native byte order and scalar type), which the header
+// records so a cache built on a different platform or build is rejected.
+constexpr char MeshMagic[8] = {'T', 'R', 'M', 'E', 'S', 'H', '\0', '\0'};
+constexpr std::uint32_t MeshVersion = 1;
+constexpr std::uint32_t MeshByteOrder = 0x01020304;
+constexpr std::uint64_t MeshAlignment = 64;
 
-    int vertex_index = std::stoi(face.substr(0, first_slash)) - 1;
-    int normal_index = std::stoi(face.substr(second_slash + 1)) - 1;
+enum MeshArray {
+    MeshVertices,
+    MeshUVs,
+    MeshNormals,
+    MeshVertexFaces,
+    MeshUVFaces,
+    MeshNormalFaces,
+    MeshArrayCount,
+};
 
-    return {vertex_index, normal_index};
+constexpr std::uint64_t MeshElementSizes[MeshArrayCount] = {sizeof(Vec3), sizeof(Vec2), sizeof(Vec3), sizeof(Face), sizeof(Face), sizeof(Face)};
+
+// Caches of the two precisions can't be shared, so they sit side by side, as do those of
+// optimized meshes
+constexpr const char* MeshExtension = sizeof(Real) == sizeof(double) ? ".trmesh" : ".f32.trmesh";
+constexpr const char* OptimizedMeshExtension = sizeof(Real) == sizeof(double) ? ".opt.trmesh" : ".opt.f32.trmesh";
+
+struct MeshHeader {
+    char magic[8] = {'T', 'R', 'M', 'E', 'S', 'H', '\0', '\0'};
+    std::uint32_t version = MeshVersion;
+    std::uint32_t byte_order = MeshByteOrder;
+    std::uint32_t scalar_size = sizeof(Real);
+    std::uint32_t reserved = 0;
+    std::uint64_t counts[MeshArrayCount] = {};
+    std::uint64_t offsets[MeshArrayCount] = {};
+};
+
+// Creates an empty file next to path, under a name no other writer gets, and returns
+// that name, or an empty string on failure
+std::string createTempFile(const std::string& path) {
+#ifdef TINYRENDERER_MKSTEMP
+    std::string name = path + ".XXXXXX";
+    const int fd = ::mkstemp(name.data());
+    if (fd < 0) {
+        return {};
+    }
+    // mkstemp() makes the file private to its owner, but other users may share the cache
+    ::fchmod(fd, 0644);
+    ::close(fd);
+    return name;
+#else
+    // Unique across threads by the thread id and across processes by the random part
+    std::string name = path + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "."
+                       + std::to_string(std::random_device{}()) + ".tmp";
+    return std::ofstream{name, std::ios::binary} ? name : std::string{};
+#endif
 }
 
-void Model::loadFacesFromObjs(const std::string& file_name) {
-    std::ifstream model_file{"obj/" + file_name};
+std::uint64_t alignMeshOffset(const std::uint64_t offset) {
+    return (offset + MeshAlignment - 1) / MeshAlignment * MeshAlignment;
+}
 
-    if (!model_file) {
-        std::cerr << "Could not find file!\n";
-        return;
+// Index of the first of the elements equal to each element of values, by sorting them
+template <typename T, typename Less>
+std::vector<int> firstEqual(const std::span<const T> values, const Less less) {
+    std::vector<int> order(values.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+        return less(values[a], values[b]);
+    });
+    std::vector<int> first(values.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        const bool repeated = i > 0 && !less(values[order[i - 1]], values[order[i]]);
+        first[order[i]] = repeated ? first[order[i - 1]] : order[i];
     }
+    return first;
+}
 
-    {
-        std::string line{};
-        while (std::getline(model_file, line)) {
-            if (line == "s 1") {
-                break;
+template <int N>
+std::vector<int> firstEqual(const std::span<const Vector<N>> values) {
+    return firstEqual(values, [](const Vector<N>& a, const Vector<N>& b) {
+        for (int i = 0; i < N; ++i) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i];
+            }
+        }
+        return false;
+    });
+}
+
+template <typename T>
+std::span<const T> meshArray(const MappedFile& file, const MeshHeader& header, const MeshArray array) {
+    return {reinterpret_cast<const T*>(file.data() + header.offsets[array]), static_cast<std::size_t>(header.counts[array])};
+}
+
+// Whether every index of faces is within [0, count), or is -1 for an optional attribute
+bool validFaces(const std::span<const Face> faces, const std::size_t count, const bool optional) {
+    const int first = optional ? -1 : 0;
+    for (const Face& face : faces) {
+        for (const int index : face) {
+            if (index < first || (index >= 0 && static_cast<std::size_t>(index) >= count)) {
+                return false;
             }
         }
     }
+    return true;
+}
+
+}
 
-    char first_char;
-    std::string face1, face2, face3;
-    while (model_file >> first_char >> face1 >> face2 >> face3) {
-        if (first_char == 'f') {
-            auto [v1, n1] = parseFaceIndices(face1);
-            auto [v2, n2] = parseFaceIndices(face2);
-            auto [v3, n3] = parseFaceIndices(face3);
+bool Model::loadObj(const std::string& file_name) {
+    const std::string path = "obj/" + file_name;
+    const MappedFile file{path};
+    if (!file.isOpen()) {
+        std::cerr << "can't open file " << path << "\n";
+        return false;
+    }
 
-            _vertexFaces.emplace_back(v1, v2, v3);
-            _normalFaces.emplace_back(n1, n2, n3);
+    std::size_t num_chunks = 1;
+#ifdef _OPENMP
+    if (file.size() >= ParallelParseThreshold) {
+        num_chunks = omp_get_max_threads();
+    }
+#endif
+    const std::vector<std::string_view> pieces = splitLines(file.view(), num_chunks);
+    // The arrays of a chunk take about as many bytes as its text, which is the first
+    // block of its arena. Both are freed at the end, all blocks at once.
+    std::deque<std::pmr::monotonic_buffer_resource> arenas;
+    std::deque<ObjChunk> chunks;
+    for (const std::string_view piece : pieces) {
+        chunks.emplace_back(&arenas.emplace_back(piece.size()));
+    }
+
+#pragma omp parallel for schedule(static) if (chunks.size() > 1)
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        parseObjChunk(pieces[c], chunks[c]);
+    }
+
+    clear();
+    std::size_t num_faces = 0;
+    for (const ObjChunk& chunk : chunks) {
+        if (chunk.malformed) {
+            std::cerr << "malformed OBJ data in " << path << "\n";
+            return false;
+        }
+        append(_vertices, chunk.vertices);
+        append(_uvs, chunk.uvs);
+        append(_normals, chunk.normals);
+        num_faces += chunk.vertexIndices.size() / 3;
+    }
+    _vertexFaces.reserve(num_faces);
+    _uvFaces.reserve(num_faces);
+    _normalFaces.reserve(num_faces);
+
+    int vertex_base = 0, uv_base = 0, normal_base = 0;
+    for (ObjChunk& chunk : chunks) {
+        if (!appendFaces(_vertexFaces, chunk.vertexIndices, chunk.vertexFixups, vertex_base, _vertices.size(), false)
+            || !appendFaces(_uvFaces, chunk.uvIndices, chunk.uvFixups, uv_base, _uvs.size(), true)
+            || !appendFaces(_normalFaces, chunk.normalIndices, chunk.normalFixups, normal_base, _normals.size(), true)) {
+            std::cerr << "face index out of range in " << path << "\n";
+            return false;
+        }
+        vertex_base += chunk.vertices.size();
+        uv_base += chunk.uvs.size();
+        normal_base += chunk.normals.size();
+    }
+    bindVectors();
+    computeBounds();
+    return true;
+}
+
+bool Model::loadMesh(const std::string& path) {
+    MappedFile file{path};
+    if (!file.isOpen()) {
+        std::cerr << "can't open file " << path << "\n";
+        return false;
+    }
+
+    MeshHeader header;
+    if (file.size() < sizeof(header)) {
+        std::cerr << "bad mesh file " << path << "\n";
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, MeshMagic, sizeof(MeshMagic)) != 0
+        || header.version != MeshVersion
+        || header.byte_order != MeshByteOrder
+        || header.scalar_size != sizeof(Real)) {
+        std::cerr << "bad mesh file " << path << "\n";
+        return false;
+    }
+    for (int a = 0; a < MeshArrayCount; ++a) {
+        if (header.offsets[a] % MeshAlignment != 0 || header.offsets[a] > file.size()
+            || header.counts[a] > (file.size() - header.offsets[a]) / MeshElementSizes[a]) {
+            std::cerr << "truncated mesh file " << path << "\n";
+            return false;
+        }
+    }
+    // The faces are indexed without checks once loaded, so a corrupt cache must not get
+    // that far
+    const std::uint64_t num_faces = header.counts[MeshVertexFaces];
+    if (header.counts[MeshUVFaces] != num_faces || header.counts[MeshNormalFaces] != num_faces
+        || !validFaces(meshArray<Face>(file, header, MeshVertexFaces), header.counts[MeshVertices], false)
+        || !validFaces(meshArray<Face>(file, header, MeshUVFaces), header.counts[MeshUVs], true)
+        || !validFaces(meshArray<Face>(file, header, MeshNormalFaces), header.counts[MeshNormals], true)) {
+        std::cerr << "bad mesh file " << path << "\n";
+        return false;
+    }
+
+    clear();
+    _mesh = std::move(file);
+    _vertexView = meshArray<Vec3>(_mesh, header, MeshVertices);
+    _uvView = meshArray<Vec2>(_mesh, header, MeshUVs);
+    _normalView = meshArray<Vec3>(_mesh, header, MeshNormals);
+    _vertexFaceView = meshArray<Face>(_mesh, header, MeshVertexFaces);
+    _uvFaceView = meshArray<Face>(_mesh, header, MeshUVFaces);
+    _normalFaceView = meshArray<Face>(_mesh, header, MeshNormalFaces);
+    computeBounds();
+    return true;
+}
+
+bool Model::saveMesh(const std::string& path) const {
+    const void* arrays[MeshArrayCount] = {_vertexView.data(), _uvView.data(), _normalView.data(),
+                                          _vertexFaceView.data(), _uvFaceView.data(), _normalFaceView.data()};
+    MeshHeader header;
+    header.counts[MeshVertices] = _vertexView.size();
+    header.counts[MeshUVs] = _uvView.size();
+    header.counts[MeshNormals] = _normalView.size();
+    header.counts[MeshVertexFaces] = _vertexFaceView.size();
+    header.counts[MeshUVFaces] = _uvFaceView.size();
+    header.counts[MeshNormalFaces] = _normalFaceView.size();
+    std::uint64_t offset = alignMeshOffset(sizeof(header));
+    for (int a = 0; a < MeshArrayCount; ++a) {
+        header.offsets[a] = offset;
+        offset = alignMeshOffset(offset + header.counts[a] * MeshElementSizes[a]);
+    }
+
+    // Written under a temporary name of its own and renamed, so concurrent readers never
+    // map a partially written cache, and concurrent writers never write into each
+    // other's file.
+    const std::string tmp_path = createTempFile(path);
+    if (tmp_path.empty()) {
+        std::cerr << "can't create a temporary file for " << path << "\n";
+        return false;
+    }
+    std::error_code ec;
+    {
+        std::ofstream out{tmp_path, std::ios::binary};
+        if (!out) {
+            std::cerr << "can't open file " << tmp_path << "\n";
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+        const char padding[MeshAlignment] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t written = sizeof(header);
+        for (int a = 0; a < MeshArrayCount; ++a) {
+            out.write(padding, header.offsets[a] - written);
+            out.write(static_cast<const char*>(arrays[a]), header.counts[a] * MeshElementSizes[a]);
+            written = header.offsets[a] + header.counts[a] * MeshElementSizes[a];
+        }
+        out.write(padding, offset - written);
+        if (!out) {
+            std::cerr << "can't write mesh file " << tmp_path << "\n";
+            out.close();
+            std::filesystem::remove(tmp_path, ec);
+            return false;
         }
     }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "can't write mesh file " << path << "\n";
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
 }
 
-void Model::loadNormalsFromObj(const std::string& file_name) {
-    std::ifstream model_file{"obj/" + file_name};
+void Model::optimize() {
+    const std::size_t num_faces = _vertexFaceView.size();
+    const std::vector<int> positions = firstEqual(_vertexView);
+    const std::vector<int> uvs = firstEqual(_uvView);
+    const std::vector<int> normals = firstEqual(_normalView);
+    // Attributes of every face corner, equal values having the same index. Corners with
+    // the same attributes are one vertex, numbered by its first corner.
+    std::vector<std::array<int, 3>> corners(num_faces * 3);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        for (int k = 0; k < 3; ++k) {
+            const int uv = _uvFaceView[f][k];
+            const int normal = _normalFaceView[f][k];
+            corners[f * 3 + k] = {positions[_vertexFaceView[f][k]], uv < 0 ? -1 : uvs[uv], normal < 0 ? -1 : normals[normal]};
+        }
+    }
+    const std::vector<int> vertex_ids = firstEqual(std::span<const std::array<int, 3>>{corners}, std::less<>{});
+    std::vector<Face> welded(num_faces);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        welded[f] = {vertex_ids[f * 3], vertex_ids[f * 3 + 1], vertex_ids[f * 3 + 2]};
+    }
 
-    if (!model_file) {
-        std::cerr << "Could not find file!\n";
-        return;
+    const int num_ids = static_cast<int>(corners.size());
+    const std::vector<int> order = optimizeTriangleOrder(welded, num_ids);
+    std::vector<Face> faces(num_faces);
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        faces[f] = welded[order[f]];
     }
+    const std::vector<int> remap = optimizeVertexOrder(faces, num_ids);
+    const int num_vertices = num_ids > 0 ? *std::max_element(remap.begin(), remap.end()) + 1 : 0;
 
-    // With this we're going through the whole file
-    // even when we're done with parsing normals.
-    // Do I care at the moment? No
-    std::string line{};
-    while (std::getline(model_file, line)) {
-        if (line.substr(0, 2) == "vn") {
-            std::istringstream iss(line.substr(3));
-            float x, y, z;
-            if (iss >> x >> y >> z) {
-                _normals.emplace_back(x, y, z);
+    // Corners without a texture coordinate or a normal keep -1 in the face arrays, and
+    // their vertex a zero in the attribute array, which is only kept if used at all
+    std::vector<Vec3> new_vertices(num_vertices);
+    std::vector<Vec2> new_uvs(num_vertices);
+    std::vector<Vec3> new_normals(num_vertices);
+    std::vector<Face> uv_faces(num_faces), normal_faces(num_faces);
+    bool has_uvs = false, has_normals = false;
+    for (std::size_t f = 0; f < num_faces; ++f) {
+        for (int k = 0; k < 3; ++k) {
+            const std::array<int, 3>& corner = corners[faces[f][k]];
+            const int v = remap[faces[f][k]];
+            faces[f][k] = v;
+            new_vertices[v] = _vertexView[corner[0]];
+            uv_faces[f][k] = corner[1] < 0 ? -1 : v;
+            normal_faces[f][k] = corner[2] < 0 ? -1 : v;
+            if (corner[1] >= 0) {
+                new_uvs[v] = _uvView[corner[1]];
+                has_uvs = true;
+            }
+            if (corner[2] >= 0) {
+                new_normals[v] = _normalView[corner[2]];
+                has_normals = true;
             }
         }
     }
+    if (!has_uvs) {
+        new_uvs.clear();
+    }
+    if (!has_normals) {
+        new_normals.clear();
+    }
+
+    clear();
+    _vertices = std::move(new_vertices);
+    _uvs = std::move(new_uvs);
+    _normals = std::move(new_normals);
+    _vertexFaces = std::move(faces);
+    _uvFaces = std::move(uv_faces);
+    _normalFaces = std::move(normal_faces);
+    bindVectors();
+    computeBounds();
+}
+
+std::vector<Model> Model::simplified(const std::span<const std::size_t> target_faces, std::vector<Real>& errors) const {
+    PROFILE_SCOPE("simplify");
+    std::vector<SimplifiedFaces> levels =
+        simplifyFaces(_vertexView, firstEqual(_vertexView), _vertexFaceView, _uvFaceView, _normalFaceView, target_faces);
+
+    // Attributes are renumbered by first use, dropping those of the removed faces
+    const auto compact = [](const auto values, std::vector<Face>& faces, auto& used) {
+        std::vector<int> remap(values.size(), -1);
+        for (Face& face : faces) {
+            for (int& index : face) {
+                if (index >= 0) {
+                    if (remap[index] < 0) {
+                        remap[index] = static_cast<int>(used.size());
+                        used.push_back(values[index]);
+                    }
+                    index = remap[index];
+                }
+            }
+        }
+    };
+    std::vector<Model> models(levels.size());
+    errors.clear();
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        Model& model = models[i];
+        compact(_vertexView, levels[i].vertex_faces, model._vertices);
+        compact(_uvView, levels[i].uv_faces, model._uvs);
+        compact(_normalView, levels[i].normal_faces, model._normals);
+        model._vertexFaces = std::move(levels[i].vertex_faces);
+        model._uvFaces = std::move(levels[i].uv_faces);
+        model._normalFaces = std::move(levels[i].normal_faces);
+        model.bindVectors();
+        model.computeBounds();
+        errors.push_back(levels[i].error);
+    }
+    return models;
+}
+
+bool Model::load(const std::string& file_name, const bool write_cache, const bool optimize_mesh) {
+    PROFILE_SCOPE("load");
+    const std::filesystem::path obj_path = "obj/" + file_name;
+    const std::string mesh_path = std::filesystem::path{obj_path}.replace_extension(optimize_mesh ? OptimizedMeshExtension : MeshExtension).string();
+
+    std::error_code obj_ec, mesh_ec;
+    const auto obj_time = std::filesystem::last_write_time(obj_path, obj_ec);
+    const auto mesh_time = std::filesystem::last_write_time(mesh_path, mesh_ec);
+    if (!mesh_ec && (obj_ec || mesh_time >= obj_time) && loadMesh(mesh_path)) {
+        if (optimize_mesh) {
+            std::cerr << "optimized " << obj_path.string() << " (cached): " << _vertexView.size() << " vertices, ACMR "
+                      << acmr(_vertexFaceView) << "\n";
+        }
+        return true;
+    }
+    if (!loadObj(file_name)) {
+        return false;
+    }
+    if (optimize_mesh) {
+        const double original_acmr = acmr(_vertexFaceView);
+        optimize();
+        std::cerr << "optimized " << obj_path.string() << ": " << _vertexView.size() << " vertices, ACMR " << original_acmr << " -> "
+                  << acmr(_vertexFaceView) << "\n";
+    }
+    if (write_cache) {
+        saveMesh(mesh_path);
+    }
+    return true;
 }
 
-std::vector<Vec3> Model::getVertices() {
-    return _vertices;
+std::span<const Vec3> Model::getVertices() const {
+    return _vertexView;
 }
 
-std::vector<Vec3> Model::getNormals() {
-    return _normals;
+std::span<const Vec2> Model::getUVs() const {
+    return _uvView;
 }
 
-std::vector<std::tuple<int, int, int>> Model::getVertexFaces() {
-    return _vertexFaces;
+std::span<const Vec3> Model::getNormals() const {
+    return _normalView;
+}
+
+std::span<const Face> Model::getVertexFaces() const {
+    return _vertexFaceView;
+}
+
+std::span<const Face> Model::getUVFaces() const {
+    return _uvFaceView;
+}
+
+std::span<const Face> Model::getNormalFaces() const {
+    return _normalFaceView;
+}
+
+const AABB& Model::getBounds() const {
+    return _bounds;
+}
+
+void Model::clear() {
+    _vertices.clear();
+    _uvs.clear();
+    _normals.clear();
+    _vertexFaces.clear();
+    _uvFaces.clear();
+    _normalFaces.clear();
+    _mesh = MappedFile{};
+    bindVectors();
+    computeBounds();
+}
+
+void Model::bindVectors() {
+    _vertexView = _vertices;
+    _uvView = _uvs;
+    _normalView = _normals;
+    _vertexFaceView = _vertexFaces;
+    _uvFaceView = _uvFaces;
+    _normalFaceView = _normalFaces;
+}
+
+void Model::computeBounds() {
+    _bounds = {};
+    for (const Vec3& v : _vertexView) {
+        _bounds.extend(v);
+    }
 }
@@ -1,28 +1,77 @@
 #pragma once
 
+#include "aabb.h"
+#include "mapped_file.h"
 #include "vector.h"
 
+#include <array>
+#include <cstddef>
+#include <span>
 #include <string>
-#include <tuple>
 #include <vector>
 
+// Indices of the three corners of a triangle into one of the model's attribute arrays
+using Face = std::array<int, 3>;
+
 class Model {
 public:
     Model() = default;
 
-    void loadVerticesFromObj(const std::string& file_name);
-    void loadFacesFromObjs(const std::string& file_name);
-    void loadNormalsFromObj(const std::string& file_name);
-    std::vector<Vec3> getVertices();
-    std::vector<Vec3> getNormals();
-    std::vector<std::tuple<int, int, int>> getVertexFaces();
-    std::vector<std::tuple<int, int, int>> getNormalFaces();
+    // Loads obj/<file_name> through its binary cache (the same path with a .trmesh
+    // extension). The cache is used when it is at least as new as the OBJ file and is
+    // otherwise (re)built from the OBJ file when write_cache is set. With optimize_mesh
+    // the OBJ file is optimized (see optimize()) before being cached, in a cache of its
+    // own, and the ACMR before and after is reported on stderr.
+    bool load(const std::string& file_name, const bool write_cache = true, const bool optimize_mesh = false);
+    // Parses positions, texture coordinates, normals and faces of obj/<file_name> in a
+    // single pass over the memory-mapped file. Polygons are fan-triangulated and indices
+    // missing from a face corner (e.g. "f 1//1") are stored as -1.
+    bool loadObj(const std::string& file_name);
+    // Maps a .trmesh file (a path, not relative to obj/). The attribute and face arrays
+    // are used in place, without being copied or parsed.
+    bool loadMesh(const std::string& path);
+    // Writes the model as a .trmesh file, this is the OBJ to binary cache converter
+    bool saveMesh(const std::string& path) const;
+    // Welds the face corners with equal positions, texture coordinates and normals into
+    // unique vertices, which the three face arrays then index alike, reorders the faces
+    // for vertex reuse (optimizeTriangleOrder) and the vertices by first use. Unused
+    // attributes are dropped.
+    void optimize();
+    // Copies of the model with its faces simplified down to each of target_faces in turn,
+    // or as far as simplifyFaces() gets, keeping only the attributes they still use.
+    // errors receives the error of each, a distance in object space.
+    std::vector<Model> simplified(std::span<const std::size_t> target_faces, std::vector<Real>& errors) const;
+
+    std::span<const Vec3> getVertices() const;
+    std::span<const Vec2> getUVs() const;
+    std::span<const Vec3> getNormals() const;
+    std::span<const Face> getVertexFaces() const;
+    std::span<const Face> getUVFaces() const;
+    std::span<const Face> getNormalFaces() const;
+    // Object-space bounds of the vertices
+    const AABB& getBounds() const;
 
 private:
-    int parseFaceIndex(const std::string& face);
+    void clear();
+    void bindVectors();
+    void computeBounds();
 
+    // Storage for models parsed from OBJ files
     std::vector<Vec3> _vertices;
+    std::vector<Vec2> _uvs;
     std::vector<Vec3> _normals;
-    std::vector<std::tuple<int, int, int>> _vertexFaces;
-    std::vector<std::tuple<int, int, int>> _normalFaces;
+    std::vector<Face> _vertexFaces;
+    std::vector<Face> _uvFaces;
+    std::vector<Face> _normalFaces;
+    // Storage for models mapped from .trmesh files
+    MappedFile _mesh;
+
+    // Whichever of the two storages is in use
+    std::span<const Vec3> _vertexView;
+    std::span<const Vec2> _uvView;
+    std::span<const Vec3> _normalView;
+    std::span<const Face> _vertexFaceView;
+    std::span<const Face> _uvFaceView;
+    std::span<const Face> _normalFaceView;
+    AABB _bounds;
 };
@@ -0,0 +1,317 @@
+#include "post.h"
+
+#include "frame_arena.h"
+#include "profile.h"
+#include "zbuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+
+namespace {
+
+// FXAA parameters, in the units of the luma of the encoded colours (0 to 1): the
+// longest blur along an edge in pixels, the local contrast below which pixels are
+// left alone, and the bounds of the reduction keeping the blur of flat areas short
+constexpr Real FxaaSpanMax = 8;
+constexpr Real FxaaEdgeThreshold = Real{1} / 8;
+constexpr Real FxaaEdgeThresholdMin = Real{1} / 32;
+constexpr Real FxaaReduceMul = Real{1} / 8;
+constexpr Real FxaaReduceMin = Real{1} / 128;
+// Border a tile needs around its colours for the FXAA taps, which reach FxaaSpanMax / 2
+// pixels away and are filtered bilinearly
+constexpr int FxaaBorder = static_cast<int>(FxaaSpanMax) / 2 + 1;
+
+// Pixels of a tile and of its border, with the colours after the curve and, for FXAA,
+// their lumas
+template <int Bytespp>
+struct TileColors {
+    explicit TileColors(std::pmr::memory_resource* resource)
+        : bytes(resource), lumas(resource) {
+    }
+
+    int width = 0;
+    int height = 0;
+    std::pmr::vector<std::uint8_t> bytes;
+    std::pmr::vector<float> lumas;
+
+    const std::uint8_t* at(const int x, const int y) const {
+        return bytes.data() + (static_cast<std::size_t>(y) * width + x) * Bytespp;
+    }
+
+    Real lumaAt(const int x, const int y) const {
+        return lumas[static_cast<std::size_t>(y) * width + x];
+    }
+
+    static float luma(const std::uint8_t* p) {
+        if constexpr (Bytespp == 1) {
+            return p[0] * (1.0f / 255);
+        } else {
+            return (0.114f * p[0] + 0.587f * p[1] + 0.299f * p[2]) * (1.0f / 255);
+        }
+    }
+
+    // Bilinear sample of the colour channels at (x, y), clamped to the tile and border
+    void sample(const Real x, const Real y, Real* out) const {
+        constexpr int Colors = std::min(Bytespp, 3);
+        const Real cx = std::clamp(x, Real{0}, static_cast<Real>(width - 1));
+        const Real cy = std::clamp(y, Real{0}, static_cast<Real>(height - 1));
+        const int x0 = std::min(static_cast<int>(cx), width - 2);
+        const int y0 = std::min(static_cast<int>(cy), height - 2);
+        const Real fx = cx - x0;
+        const Real fy = cy - y0;
+        const std::uint8_t* p00 = at(x0, y0);
+        const std::uint8_t* p01 = at(x0, y0 + 1);
+        for (int c = 0; c < Colors; ++c) {
+            const Real top = p00[c] + (p00[c + Bytespp] - p00[c]) * fx;
+            const Real bottom = p01[c] + (p01[c + Bytespp] - p01[c]) * fx;
+            out[c] = top + (bottom - top) * fy;
+        }
+    }
+};
+
+// FXAA of the pixel at (x, y) of colors, the variant blurring along the edge direction
+// given by the luma of the diagonal neighbours, which needs no search along the edge
+template <int Bytespp>
+void fxaa(const TileColors<Bytespp>& colors, const int x, const int y, std::uint8_t* out) {
+    using Tile = TileColors<Bytespp>;
+    constexpr int Colors = std::min(Bytespp, 3);
+    const std::uint8_t* m = colors.at(x, y);
+    const Real luma_m = colors.lumaAt(x, y);
+    const Real luma_nw = colors.lumaAt(x - 1, y - 1);
+    const Real luma_ne = colors.lumaAt(x + 1, y - 1);
+    const Real luma_sw = colors.lumaAt(x - 1, y + 1);
+    const Real luma_se = colors.lumaAt(x + 1, y + 1);
+    const Real luma_min = std::min({luma_m, luma_nw, luma_ne, luma_sw, luma_se});
+    const Real luma_max = std::max({luma_m, luma_nw, luma_ne, luma_sw, luma_se});
+    std::memcpy(out, m, Bytespp);
+    if (luma_max - luma_min < std::max(FxaaEdgeThresholdMin, luma_max * FxaaEdgeThreshold)) {
+        return;
+    }
+
+    Real dx = -((luma_nw + luma_ne) - (luma_sw + luma_se));
+    Real dy = (luma_nw + luma_sw) - (luma_ne + luma_se);
+    const Real reduce = std::max((luma_nw + luma_ne + luma_sw + luma_se) * (Real{0.25} * FxaaReduceMul), FxaaReduceMin);
+    const Real scale = 1 / (std::min(std::abs(dx), std::abs(dy)) + reduce);
+    dx = std::clamp(dx * scale, -FxaaSpanMax, FxaaSpanMax);
+    dy = std::clamp(dy * scale, -FxaaSpanMax, FxaaSpanMax);
+
+    Real a0[Colors], a1[Colors], b0[Colors], b1[Colors];
+    colors.sample(x + dx * (Real{1} / 3 - Real{0.5}), y + dy * (Real{1} / 3 - Real{0.5}), a0);
+    colors.sample(x + dx * (Real{2} / 3 - Real{0.5}), y + dy * (Real{2} / 3 - Real{0.5}), a1);
+    colors.sample(x - dx * Real{0.5}, y - dy * Real{0.5}, b0);
+    colors.sample(x + dx * Real{0.5}, y + dy * Real{0.5}, b1);
+    std::uint8_t a[Bytespp], b[Bytespp];
+    for (int c = 0; c < Colors; ++c) {
+        const Real rgb_a = (a0[c] + a1[c]) / 2;
+        a[c] = static_cast<std::uint8_t>(rgb_a + Real{0.5});
+        b[c] = static_cast<std::uint8_t>(rgb_a / 2 + (b0[c] + b1[c]) / 4 + Real{0.5});
+    }
+    // The wider blur is kept unless it brings in a luma the neighbourhood does not have
+    const Real luma_b = Tile::luma(b);
+    std::memcpy(out, luma_b < luma_min || luma_b > luma_max ? a : b, Colors);
+}
+
+}
+
+PostProcess::PostProcess(const PostSettings& settings)
+    : _settings(settings) {
+    for (std::size_t i = 0; i < _curve.size(); ++i) {
+        Real x = static_cast<Real>(i) / (CurveScale * 255);
+        if (settings.exposure > 0) {
+            x = (1 - std::exp(-settings.exposure * x)) / (1 - std::exp(-settings.exposure));
+        }
+        if (settings.gamma != 1) {
+            x = std::pow(x, 1 / settings.gamma);
+        }
+        _curve[i] = static_cast<std::uint8_t>(std::clamp(x, Real{0}, Real{1}) * 255 + Real{0.5});
+    }
+}
+
+bool PostProcess::enabled() const {
+    return _settings.ao_strength > 0 || _settings.exposure > 0 || _settings.gamma != 1 || _settings.fxaa;
+}
+
+template <typename Format, int Samples>
+void PostProcess::apply(const RenderTarget<Format, Samples>& target, const ZBuffer& zbuffer, TGAImage& image, const bool vflip) const {
+    constexpr int Bytespp = Format::Bytespp;
+    constexpr int Colors = std::min(Bytespp, 3);
+    const int width = target.width();
+    const int height = target.height();
+    if (image.width() != width || image.height() != height || image.bytespp() != Bytespp || image.is_flipped()) {
+        image = TGAImage(width, height, Bytespp);
+    }
+    const std::size_t row_bytes = static_cast<std::size_t>(width) * Bytespp;
+    std::uint8_t* const pixels = image.buffer();
+    const int border = _settings.fxaa ? FxaaBorder : 0;
+    const int radius = _settings.ao_strength > 0 ? _settings.ao_radius : 0;
+    const int tiles_x = (width + TileSize - 1) / TileSize;
+    const int num_tiles = tiles_x * ((height + TileSize - 1) / TileSize);
+
+#pragma omp parallel
+    {
+        // Per thread: the depths around the tile and border, their sums along rows, the
+        // occlusion factors, a row of source colours and the colours after the curve. The
+        // filters run in float, which is precise enough for an average of depths and
+        // doubles the lanes of their vector loops. They live in the frame arena of
+        // the thread.
+        FrameArena& arena = frameArena();
+        std::pmr::vector<float> depths(&arena), row_sums(&arena), occlusion(&arena);
+        std::pmr::vector<std::uint8_t> source(&arena);
+        TileColors<Bytespp> colors(&arena);
+
+#pragma omp for schedule(dynamic)
+        for (int tile = 0; tile < num_tiles; ++tile) {
+            PROFILE_SCOPE("post");
+            const int tx0 = tile % tiles_x * TileSize;
+            const int ty0 = tile / tiles_x * TileSize;
+            const int tx1 = std::min(tx0 + TileSize, width) - 1;
+            const int ty1 = std::min(ty0 + TileSize, height) - 1;
+            // Region of the colours, in which coordinates beyond the edges of the target
+            // repeat the edges
+            const int cx0 = tx0 - border;
+            const int cy0 = ty0 - border;
+            const int cw = tx1 - tx0 + 1 + 2 * border;
+            const int ch = ty1 - ty0 + 1 + 2 * border;
+
+            if (radius > 0) {
+                // Empty pixels are NaN, which fails the range checks below, so the
+                // background neither occludes nor is occluded
+                const int dx0 = cx0 - radius;
+                const int dw = cw + 2 * radius;
+                const int dh = ch + 2 * radius;
+                const int sx0 = std::max(dx0, 0);
+                const int sx1 = std::min(dx0 + dw - 1, width - 1);
+                depths.resize(static_cast<std::size_t>(dw) * dh);
+                for (int j = 0; j < dh; ++j) {
+                    const int y = std::clamp(cy0 - radius + j, 0, height - 1);
+                    float* d = depths.data() + static_cast<std::size_t>(j) * dw - dx0;
+                    for (int x = sx0; x <= sx1;) {
+                        const int n = std::min(ZBuffer::BlockSize - x % ZBuffer::BlockSize, sx1 - x + 1);
+                        const Real* z = zbuffer.span(x, y);
+                        for (int k = 0; k < n; ++k) {
+                            d[x + k] = z[k] == ZBuffer::Far ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(z[k]);
+                        }
+                        x += n;
+                    }
+                    std::fill(d + dx0, d + sx0, d[sx0]);
+                    std::fill(d + sx1 + 1, d + dx0 + dw, d[sx1]);
+                }
+                // The mean difference to the depths around a pixel is split into the
+                // differences along every row to the depth in the pixel's column, then
+                // down the column to the pixel, so the filter is separable. A difference
+                // beyond the range is another surface, and counts as none. The taps are
+                // the outer loops, leaving straight loops over the pixels to vectorize.
+                const int taps = 2 * radius + 1;
+                const float range = static_cast<float>(_settings.ao_range);
+                row_sums.assign(static_cast<std::size_t>(cw) * dh, 0);
+                for (int j = 0; j < dh; ++j) {
+                    const float* d = depths.data() + static_cast<std::size_t>(j) * dw;
+                    const float* center = d + radius;
+                    float* sums = row_sums.data() + static_cast<std::size_t>(j) * cw;
+                    for (int k = 0; k < taps; ++k) {
+#pragma omp simd
+                        for (int i = 0; i < cw; ++i) {
+                            const float difference = d[i + k] - center[i];
+                            sums[i] += std::abs(difference) < range ? difference : 0;
+                        }
+                    }
+                }
+                const float strength = static_cast<float>(_settings.ao_strength);
+                const float norm = 1.0f / static_cast<float>(taps * taps);
+                occlusion.assign(static_cast<std::size_t>(cw) * ch, 0);
+                for (int j = 0; j < ch; ++j) {
+                    const float* d = depths.data() + static_cast<std::size_t>(j) * dw + radius;
+                    const float* center = d + static_cast<std::size_t>(radius) * dw;
+                    float* ao = occlusion.data() + static_cast<std::size_t>(j) * cw;
+                    for (int k = 0; k < taps; ++k) {
+                        const float* dk = d + static_cast<std::size_t>(k) * dw;
+                        const float* sums = row_sums.data() + static_cast<std::size_t>(j + k) * cw;
+#pragma omp simd
+                        for (int i = 0; i < cw; ++i) {
+                            const float difference = dk[i] - center[i];
+                            const float sum = sums[i] + static_cast<float>(taps) * difference;
+                            ao[i] += std::abs(difference) < range ? sum : 0;
+                        }
+                    }
+#pragma omp simd
+                    for (int i = 0; i < cw; ++i) {
+                        const float above = std::max(ao[i] * norm, 0.0f);
+                        ao[i] = std::max(1 - strength * above, 0.0f);
+                    }
+                }
+            }
+
+            // Occlusion and curve for the tile and border, then FXAA for the tile
+            colors.width = cw;
+            colors.height = ch;
+            colors.bytes.resize(static_cast<std::size_t>(cw) * ch * Bytespp);
+            colors.lumas.resize(_settings.fxaa ? static_cast<std::size_t>(cw) * ch : 0);
+            const int sx0 = std::max(cx0, 0);
+            const int sx1 = std::min(cx0 + cw - 1, width - 1);
+            source.resize(static_cast<std::size_t>(cw) * Bytespp);
+            for (int j = 0; j < ch; ++j) {
+                target.resolveSpan(sx0, sx1, std::clamp(cy0 + j, 0, height - 1), source.data() + static_cast<std::size_t>(sx0 - cx0) * Bytespp);
+                for (int i = 0; i < sx0 - cx0; ++i) {
+                    std::memcpy(source.data() + i * Bytespp, source.data() + (sx0 - cx0) * Bytespp, Bytespp);
+                }
+                for (int i = sx1 - cx0 + 1; i < cw; ++i) {
+                    std::memcpy(source.data() + i * Bytespp, source.data() + (sx1 - cx0) * Bytespp, Bytespp);
+                }
+                const std::uint8_t* in = source.data();
+                std::uint8_t* out = colors.bytes.data() + static_cast<std::size_t>(j) * cw * Bytespp;
+                if (radius > 0) {
+                    const float* ao = occlusion.data() + static_cast<std::size_t>(j) * cw;
+                    for (int i = 0; i < cw; ++i) {
+                        for (int c = 0; c < Colors; ++c) {
+                            out[i * Bytespp + c] = _curve[static_cast<int>(in[i * Bytespp + c] * (CurveScale * ao[i]))];
+                        }
+                    }
+                } else {
+                    for (int i = 0; i < cw * Bytespp; ++i) {
+                        out[i] = _curve[in[i] * CurveScale];
+                    }
+                }
+                // Alpha is not a colour, and skips the curve
+                if constexpr (Bytespp == 4) {
+                    for (int i = 0; i < cw; ++i) {
+                        out[i * Bytespp + 3] = in[i * Bytespp + 3];
+                    }
+                }
+                if (_settings.fxaa) {
+                    float* lumas = colors.lumas.data() + static_cast<std::size_t>(j) * cw;
+                    for (int i = 0; i < cw; ++i) {
+                        lumas[i] = TileColors<Bytespp>::luma(out + i * Bytespp);
+                    }
+                }
+            }
+            for (int y = ty0; y <= ty1; ++y) {
+                std::uint8_t* dst = pixels + static_cast<std::size_t>(vflip ? height - 1 - y : y) * row_bytes + static_cast<std::size_t>(tx0) * Bytespp;
+                if (!_settings.fxaa) {
+                    std::memcpy(dst, colors.at(tx0 - cx0, y - cy0), static_cast<std::size_t>(tx1 - tx0 + 1) * Bytespp);
+                    continue;
+                }
+                for (int x = tx0; x <= tx1; ++x, dst += Bytespp) {
+                    fxaa(colors, x - cx0, y - cy0, dst);
+                }
+            }
+        }
+    }
+}
+
+template void PostProcess::apply(const RenderTarget<Gray8>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGR8>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGRA8>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<Gray8, 2>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGR8, 2>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGRA8, 2>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<Gray8, 4>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGR8, 4>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGRA8, 4>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<Gray8, 8>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGR8, 8>&, const ZBuffer&, TGAImage&, const bool) const;
+template void PostProcess::apply(const RenderTarget<BGRA8, 8>&, const ZBuffer&, TGAImage&, const bool) const;
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "render_target.h"
+#include "tgaimage.h"
+#include "vector.h"
+
+#include <array>
+#include <cstdint>
+
+// Effects of a PostProcess, each one disabled by its default value
+struct PostSettings {
+    // Darkening of the pixels lying below the average depth around them, per unit of
+    // depth (unsharp masking of the depth buffer, a screen-space ambient occlusion)
+    Real ao_strength = 0;
+    // Radius of the neighbourhood ambient occlusion averages, in pixels
+    int ao_radius = 6;
+    // Largest depth difference to a neighbour counted by ambient occlusion, farther
+    // neighbours being other surfaces, e.g. a pixel of a wall seen past an object
+    Real ao_range = Real{0.05};
+    // Exponential tone curve 1 - exp(-exposure x), scaled to keep white white
+    Real exposure = 0;
+    // Display gamma the colours are encoded for
+    Real gamma = 1;
+    // FXAA edge smoothing, the directional blur of its low-cost variant
+    bool fxaa = false;
+};
+
+// Screen-space effects run on the colours and depths of a RenderTarget while resolving
+// it. All the effects happen in one sweep over tiles in parallel: a tile reads its
+// depths and colours, plus a border for the filters, and its pixels are written to the
+// image once, so the whole chain costs about one resolve().
+class PostProcess {
+public:
+    PostProcess() = default;
+    explicit PostProcess(const PostSettings& settings);
+
+    // Whether any effect is enabled
+    bool enabled() const;
+    // Like target.resolve(image, vflip), with the effects applied
+    template <typename Format, int Samples>
+    void apply(const RenderTarget<Format, Samples>& target, TGAImage& image, const bool vflip = false) const {
+        apply(target, target.depth(), image, vflip);
+    }
+    // The same with the depths taken from zbuffer rather than the target, for a target
+    // whose depths are kept elsewhere, as with a DeferredRenderer
+    template <typename Format, int Samples>
+    void apply(const RenderTarget<Format, Samples>& target, const ZBuffer& zbuffer, TGAImage& image, const bool vflip = false) const;
+
+private:
+    // The colours are multiplied by the ambient occlusion with CurveScale steps per
+    // level, and mapped by a table holding the tone curve and gamma together
+    static constexpr int CurveScale = 4;
+
+    PostSettings _settings;
+    std::array<std::uint8_t, 256 * CurveScale> _curve;
+};
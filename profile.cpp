@@ -0,0 +1,146 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace profile {
+
+namespace {
+
+struct Event {
+    const char* name;
+    std::int64_t start; // nanoseconds since Epoch
+    std::int64_t end;
+};
+
+// Everything one thread records. The buffers outlive their thread, so the events of
+// threads that have exited still show up in the reports.
+struct ThreadData {
+    std::string name;
+    std::vector<Event> events;
+    std::uint64_t counters[CounterCount] = {};
+};
+
+const auto Epoch = std::chrono::steady_clock::now();
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadData>> registry;
+
+ThreadData& threadData() {
+    thread_local ThreadData* data = [] {
+        std::lock_guard lock(registryMutex);
+        registry.push_back(std::make_unique<ThreadData>());
+        registry.back()->name = "thread " + std::to_string(registry.size() - 1);
+        return registry.back().get();
+    }();
+    return *data;
+}
+
+std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Epoch).count();
+}
+
+const char* const CounterNames[CounterCount] = {
+    "meshlets outside",
+    "meshlets back-facing",
+    "triangles submitted",
+    "triangles outside",
+    "triangles clipped",
+    "triangles back-facing",
+    "triangles rasterized",
+    "pixels HiZ-rejected",
+    "pixels tested",
+    "pixels written",
+    "pixels shaded",
+};
+
+}
+
+ScopedTimer::ScopedTimer(const char* name)
+    : _name(name), _start(now()) {
+}
+
+ScopedTimer::~ScopedTimer() {
+    threadData().events.push_back({_name, _start, now()});
+}
+
+void count(const Counter counter, const std::uint64_t n) {
+    threadData().counters[counter] += n;
+}
+
+void setThreadName(const std::string& name) {
+    threadData().name = name;
+}
+
+void writeSummary(std::ostream& out) {
+    struct Stage {
+        std::size_t calls = 0;
+        std::int64_t total = 0;
+        std::int64_t longest = 0;
+    };
+    std::map<std::string, Stage> stages;
+    std::uint64_t counters[CounterCount] = {};
+    std::lock_guard lock(registryMutex);
+    for (const auto& data : registry) {
+        for (const Event& event : data->events) {
+            Stage& stage = stages[event.name];
+            ++stage.calls;
+            stage.total += event.end - event.start;
+            stage.longest = std::max(stage.longest, event.end - event.start);
+        }
+        for (int c = 0; c < CounterCount; ++c) {
+            counters[c] += data->counters[c];
+        }
+    }
+
+    const std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "calls" << std::setw(14) << "total ms"
+        << std::setw(14) << "mean us" << std::setw(14) << "max us" << "\n";
+    for (const auto& [name, stage] : stages) {
+        out << std::left << std::setw(12) << name << std::right << std::setw(10) << stage.calls << std::setw(14) << stage.total / 1e6
+            << std::setw(14) << stage.total / 1e3 / stage.calls << std::setw(14) << stage.longest / 1e3 << "\n";
+    }
+    for (int c = 0; c < CounterCount; ++c) {
+        out << std::left << std::setw(24) << CounterNames[c] << std::right << std::setw(14) << counters[c] << "\n";
+    }
+    // Pixels hidden by nearer ones, whichever of the depth tests rejected them
+    out << std::left << std::setw(24) << "pixels depth-failed" << std::right << std::setw(14)
+        << counters[PixelsHiZRejected] + counters[PixelsTested] - counters[PixelsWritten] << "\n";
+    out.flags(flags);
+}
+
+bool writeTrace(const std::string& file_name) {
+    std::ofstream out(file_name);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << file_name << "\n";
+        return false;
+    }
+    // Trace timestamps and durations are in microseconds
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+    bool first = true;
+    std::lock_guard lock(registryMutex);
+    for (std::size_t tid = 0; tid < registry.size(); ++tid) {
+        const ThreadData& data = *registry[tid];
+        out << (first ? "\n" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << tid
+            << R"(, "args": {"name": ")" << data.name << "\"}}";
+        first = false;
+        for (const Event& event : data.events) {
+            out << ",\n"
+                << R"({"name": ")" << event.name << R"(", "ph": "X", "pid": 1, "tid": )" << tid << ", \"ts\": " << event.start / 1e3
+                << ", \"dur\": " << (event.end - event.start) / 1e3 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+}
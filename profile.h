@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Per-stage timings and pipeline counters. They are only collected when the tree is
+// configured with -Dprofiling=ON (TINYRENDERER_PROFILE); otherwise PROFILE_SCOPE and
+// PROFILE_COUNT expand to nothing and cost nothing. Every thread records into its own
+// buffers, so recording never synchronises; the reports must only be written while no
+// other thread is recording.
+namespace profile {
+
+#ifdef TINYRENDERER_PROFILE
+constexpr bool Enabled = true;
+#else
+constexpr bool Enabled = false;
+#endif
+
+enum Counter {
+    MeshletsOutside,     // meshlets dropped whole, outside the view
+    MeshletsBackfacing,  // meshlets dropped whole, facing away
+    TrianglesSubmitted,  // faces handed to the clipper
+    TrianglesOutside,    // rejected whole, outside the view
+    TrianglesClipped,    // cut by the near plane or the guard band
+    TrianglesBackfacing, // culled by setup as back-facing or smaller than a pixel
+    TrianglesRasterized, // set up and binned, including the pieces of clipped ones
+    PixelsHiZRejected,   // covered pixels failing the depth test of their tile or block
+    PixelsTested,        // covered pixels that reached the per-pixel depth test
+    PixelsWritten,       // pixels that passed it; the rest failed the depth test
+    PixelsShaded,        // runs of the fragment stage
+    CounterCount,
+};
+
+// Records the time from construction to destruction as one event of the calling thread
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* _name;
+    std::int64_t _start;
+};
+
+void count(const Counter counter, const std::uint64_t n);
+// Names the calling thread's track in the trace, which is otherwise "thread N"
+void setThreadName(const std::string& name);
+
+// Table of the total, mean and longest time of every stage and of the counters
+void writeSummary(std::ostream& out);
+// Chrome trace-event JSON (chrome://tracing, Perfetto), with one track per thread
+bool writeTrace(const std::string& file_name);
+
+}
+
+#ifdef TINYRENDERER_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) const profile::ScopedTimer PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) profile::count(profile::counter, n)
+#else
+#define PROFILE_SCOPE(name) static_cast<void>(0)
+#define PROFILE_COUNT(counter, n) static_cast<void>(0)
+#endif
@@ -0,0 +1,114 @@
+#include "render_target.h"
+
+#include <algorithm>
+
+template <typename Format, int Samples>
+RenderTarget<Format, Samples>::RenderTarget(const int width, const int height)
+    : _width(width),
+      _height(height),
+      _blocks_x((width + BlockSize - 1) / BlockSize),
+      _tiles_x((width + TileSize - 1) / TileSize),
+      _color(static_cast<std::size_t>(_blocks_x) * ((height + BlockSize - 1) / BlockSize)) {
+    for (ZBuffer& depth : _depth) {
+        depth = ZBuffer(width, height);
+    }
+    if constexpr (Samples > 1) {
+        _expanded.assign(static_cast<std::size_t>(width) * height, -1);
+        _tileSamples.resize(static_cast<std::size_t>(_tiles_x) * ((height + TileSize - 1) / TileSize));
+    }
+}
+
+template <typename Format, int Samples>
+void RenderTarget<Format, Samples>::clear() {
+    std::fill(_color.begin(), _color.end(), Block{});
+    for (ZBuffer& depth : _depth) {
+        depth.clear();
+    }
+    std::fill(_expanded.begin(), _expanded.end(), -1);
+    for (std::vector<SampleColors>& tile_samples : _tileSamples) {
+        tile_samples.clear();
+    }
+}
+
+template <typename Format, int Samples>
+int RenderTarget<Format, Samples>::width() const {
+    return _width;
+}
+
+template <typename Format, int Samples>
+int RenderTarget<Format, Samples>::height() const {
+    return _height;
+}
+
+template <typename Format, int Samples>
+void RenderTarget<Format, Samples>::average(const SampleColors& samples, std::uint8_t* out) const {
+    for (int c = 0; c < Format::Bytespp; ++c) {
+        int sum = Samples / 2;
+        for (int i = 0; i < Samples; ++i) {
+            sum += samples.bytes[i][c];
+        }
+        out[c] = static_cast<std::uint8_t>(sum / Samples);
+    }
+}
+
+template <typename Format, int Samples>
+TGAColor RenderTarget<Format, Samples>::get(const int x, const int y) const {
+    TGAColor ret = {0, 0, 0, 0, Format::Bytespp};
+    if constexpr (Samples > 1) {
+        const std::int32_t index = _expanded[static_cast<std::size_t>(y) * _width + x];
+        if (index >= 0) {
+            average(_tileSamples[static_cast<std::size_t>(y / TileSize) * _tiles_x + x / TileSize][index], ret.bgra);
+            return ret;
+        }
+    }
+    std::memcpy(ret.bgra, pixel(x, y), Format::Bytespp);
+    return ret;
+}
+
+template <typename Format, int Samples>
+void RenderTarget<Format, Samples>::resolveSpan(const int x0, const int x1, const int y, std::uint8_t* dst) const {
+    // Gathers the part of one row of each block along the span, then replaces the pixels
+    // with samples of their own by their average
+    const Block* block = _color.data() + static_cast<std::size_t>(y / BlockSize) * _blocks_x + x0 / BlockSize;
+    for (int x = x0; x <= x1; ++block) {
+        const int count = std::min(BlockSize - x % BlockSize, x1 - x + 1);
+        std::memcpy(dst + static_cast<std::size_t>(x - x0) * Format::Bytespp, block->bytes + (y % BlockSize * BlockSize + x % BlockSize) * Format::Bytespp,
+                    static_cast<std::size_t>(count) * Format::Bytespp);
+        x += count;
+    }
+    if constexpr (Samples > 1) {
+        const std::int32_t* expanded = _expanded.data() + static_cast<std::size_t>(y) * _width;
+        const std::vector<SampleColors>* tile_samples = _tileSamples.data() + static_cast<std::size_t>(y / TileSize) * _tiles_x;
+        for (int x = x0; x <= x1; ++x) {
+            if (expanded[x] >= 0) {
+                average(tile_samples[x / TileSize][expanded[x]], dst + static_cast<std::size_t>(x - x0) * Format::Bytespp);
+            }
+        }
+    }
+}
+
+template <typename Format, int Samples>
+void RenderTarget<Format, Samples>::resolve(TGAImage& image, const bool vflip) const {
+    if (image.width() != _width || image.height() != _height || image.bytespp() != Format::Bytespp || image.is_flipped()) {
+        image = TGAImage(_width, _height, Format::Bytespp);
+    }
+    const std::size_t row_bytes = static_cast<std::size_t>(_width) * Format::Bytespp;
+    std::uint8_t* const pixels = image.buffer();
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < _height; ++y) {
+        resolveSpan(0, _width - 1, y, pixels + static_cast<std::size_t>(vflip ? _height - 1 - y : y) * row_bytes);
+    }
+}
+
+template class RenderTarget<Gray8>;
+template class RenderTarget<BGR8>;
+template class RenderTarget<BGRA8>;
+template class RenderTarget<Gray8, 2>;
+template class RenderTarget<BGR8, 2>;
+template class RenderTarget<BGRA8, 2>;
+template class RenderTarget<Gray8, 4>;
+template class RenderTarget<BGR8, 4>;
+template class RenderTarget<BGRA8, 4>;
+template class RenderTarget<Gray8, 8>;
+template class RenderTarget<BGR8, 8>;
+template class RenderTarget<BGRA8, 8>;
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "tgaimage.h"
+#include "zbuffer.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+// Pixel formats of a RenderTarget. They are fixed at compile time, so writing a pixel
+// is a copy of a constant number of bytes. The byte order is the one of TGAColor and of
+// the TGA file format.
+struct Gray8 {
+    static constexpr int Bytespp = TGAImage::GRAYSCALE;
+};
+
+struct BGR8 {
+    static constexpr int Bytespp = TGAImage::RGB;
+};
+
+struct BGRA8 {
+    static constexpr int Bytespp = TGAImage::RGBA;
+};
+
+// Colour and depth buffers draw() renders into. Like the depths of the ZBuffer, the
+// colours are stored block by block, in BlockSize x BlockSize blocks that are a whole
+// number of cache lines for every format, so the pixels a tile writes never share a
+// cache line with another tile. resolve() converts the colours to the row-major layout
+// of a TGAImage.
+//
+// With Samples > 1 the target is multisampled: every sample has its own depth, kept in
+// one ZBuffer per sample, while colours are stored compactly. A pixel whose samples all
+// hold the same colour stores it once, like a single-sampled target; only a pixel that
+// was partially covered by its last triangle keeps a colour per sample, in a list owned
+// by its tile. resolve() averages the samples of those pixels.
+template <typename Format, int Samples = 1>
+class RenderTarget {
+public:
+    static_assert(Samples == 1 || Samples == 2 || Samples == 4 || Samples == 8);
+    static constexpr int BlockSize = ZBuffer::BlockSize;
+    // Coverage mask with every sample of a pixel set
+    static constexpr std::uint32_t FullMask = (1u << Samples) - 1;
+
+    RenderTarget() = default;
+    RenderTarget(const int width, const int height);
+
+    // Resets every colour to black and every depth to ZBuffer::Far
+    void clear();
+    int width() const;
+    int height() const;
+    // Depths of sample 0, the only ones of a single-sampled target
+    ZBuffer& depth() {
+        return _depth[0];
+    }
+    const ZBuffer& depth() const {
+        return _depth[0];
+    }
+    std::span<ZBuffer, Samples> sampleDepths() {
+        return _depth;
+    }
+
+    // Unlike TGAImage::set(), there is no bounds check: (x, y) must be inside the target.
+    // Sets every sample of the pixel.
+    void set(const int x, const int y, const TGAColor& c) {
+        std::memcpy(pixel(x, y), c.bgra, Format::Bytespp);
+        if constexpr (Samples > 1) {
+            _expanded[static_cast<std::size_t>(y) * _width + x] = -1;
+        }
+    }
+    // Sets the samples of the pixel in mask, bit i standing for sample i
+    void set(const int x, const int y, const TGAColor& c, const std::uint32_t mask)
+        requires(Samples > 1)
+    {
+        std::vector<SampleColors>& tile_samples = _tileSamples[static_cast<std::size_t>(y / TileSize) * _tiles_x + x / TileSize];
+        std::int32_t& index = _expanded[static_cast<std::size_t>(y) * _width + x];
+        if (index < 0) {
+            index = static_cast<std::int32_t>(tile_samples.size());
+            SampleColors& samples = tile_samples.emplace_back();
+            for (int i = 0; i < Samples; ++i) {
+                std::memcpy(samples.bytes[i], pixel(x, y), Format::Bytespp);
+            }
+        }
+        SampleColors& samples = tile_samples[index];
+        for (std::uint32_t bits = mask; bits; bits &= bits - 1) {
+            std::memcpy(samples.bytes[std::countr_zero(bits)], c.bgra, Format::Bytespp);
+        }
+    }
+    // Colour of the pixel, averaged over its samples
+    TGAColor get(const int x, const int y) const;
+
+    // Copies the colours of pixels [x0, x1] of row y to dst, Format::Bytespp bytes per
+    // pixel, averaging the samples of the pixels that have their own
+    void resolveSpan(const int x0, const int x1, const int y, std::uint8_t* dst) const;
+    // Copies the colours into image, reallocating it unless it already has the size and
+    // format of the target and its stored order is its image order. Row y of the target
+    // becomes image row y, or row height() - 1 - y when vflip is set, so a top-down image
+    // costs no pass of its own.
+    void resolve(TGAImage& image, const bool vflip = false) const;
+
+private:
+    struct alignas(CacheLineSize) Block {
+        std::uint8_t bytes[BlockSize * BlockSize * Format::Bytespp];
+    };
+    struct SampleColors {
+        std::uint8_t bytes[Samples][Format::Bytespp];
+    };
+
+    std::uint8_t* pixel(const int x, const int y) {
+        Block& block = _color[static_cast<std::size_t>(y / BlockSize) * _blocks_x + x / BlockSize];
+        return block.bytes + (y % BlockSize * BlockSize + x % BlockSize) * Format::Bytespp;
+    }
+    const std::uint8_t* pixel(const int x, const int y) const {
+        return const_cast<RenderTarget*>(this)->pixel(x, y);
+    }
+    // Average of the samples of an expanded pixel
+    void average(const SampleColors& samples, std::uint8_t* out) const;
+
+    int _width = 0;
+    int _height = 0;
+    int _blocks_x = 0;
+    int _tiles_x = 0;
+    std::vector<Block> _color;
+    std::array<ZBuffer, Samples> _depth;
+    // Per pixel, the index of its sample colours in the list of its tile, or -1 while
+    // all its samples have the colour stored in _color. Entries of pixels that were
+    // covered entirely again are only reclaimed by clear().
+    std::vector<std::int32_t> _expanded;
+    std::vector<std::vector<SampleColors>> _tileSamples;
+};
+
+extern template class RenderTarget<Gray8>;
+extern template class RenderTarget<BGR8>;
+extern template class RenderTarget<BGRA8>;
+extern template class RenderTarget<Gray8, 2>;
+extern template class RenderTarget<BGR8, 2>;
+extern template class RenderTarget<BGRA8, 2>;
+extern template class RenderTarget<Gray8, 4>;
+extern template class RenderTarget<BGR8, 4>;
+extern template class RenderTarget<BGRA8, 4>;
+extern template class RenderTarget<Gray8, 8>;
+extern template class RenderTarget<BGR8, 8>;
+extern template class RenderTarget<BGRA8, 8>;
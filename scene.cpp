@@ -0,0 +1,200 @@
+#include "scene.h"
+
+#include "frame_arena.h"
+#include "gl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <memory_resource>
+#include <utility>
+
+namespace {
+
+// Instances per leaf of the hierarchy
+constexpr int MaxLeafSize = 4;
+
+// Levels of detail of a mesh at most, and the fewest faces one is simplified to
+constexpr std::size_t MaxLods = 8;
+constexpr std::size_t MinLodFaces = 128;
+
+}
+
+int Scene::addMesh(const std::string& file_name) {
+    const auto it = std::find(_meshNames.begin(), _meshNames.end(), file_name);
+    if (it != _meshNames.end()) {
+        return static_cast<int>(it - _meshNames.begin());
+    }
+    std::vector<Lod>& lods = _meshes.emplace_back(1);
+    if (!lods[0].model.load(file_name, true, _optimizeMeshes)) {
+        _meshes.pop_back();
+        return -1;
+    }
+    lods[0].meshlets = Meshlets(lods[0].model);
+    if (_generateLods) {
+        std::vector<std::size_t> targets;
+        for (std::size_t faces = lods[0].model.getVertexFaces().size() / 2; faces >= MinLodFaces && targets.size() + 1 < MaxLods; faces /= 2) {
+            targets.push_back(faces);
+        }
+        std::vector<Real> errors;
+        std::vector<Model> models = lods[0].model.simplified(targets, errors);
+        std::cerr << "levels of detail of " << file_name << ": " << lods[0].model.getVertexFaces().size() << " faces";
+        for (std::size_t i = 0; i < models.size(); ++i) {
+            // Borders and seams which cannot move can stop the simplification short
+            if (models[i].getVertexFaces().size() * 4 > lods.back().model.getVertexFaces().size() * 3) {
+                break;
+            }
+            lods.push_back({std::move(models[i]), Meshlets{}, errors[i]});
+            lods.back().meshlets = Meshlets(lods.back().model);
+            std::cerr << ", " << lods.back().model.getVertexFaces().size() << " (error " << errors[i] << ")";
+        }
+        std::cerr << "\n";
+    }
+    _meshNames.push_back(file_name);
+    return static_cast<int>(_meshes.size()) - 1;
+}
+
+void Scene::setOptimizeMeshes(const bool optimize) {
+    _optimizeMeshes = optimize;
+}
+
+void Scene::setGenerateLods(const bool generate) {
+    _generateLods = generate;
+}
+
+int Scene::addInstance(const int mesh, const Matrix<4, 4>& transform) {
+    _instances.push_back({mesh, transform, _meshes[mesh][0].model.getBounds().transformed(transform)});
+    return static_cast<int>(_instances.size()) - 1;
+}
+
+void Scene::build() {
+    _order.resize(_instances.size());
+    for (std::size_t i = 0; i < _order.size(); ++i) {
+        _order[i] = static_cast<int>(i);
+    }
+    _nodes.clear();
+    if (!_instances.empty()) {
+        buildNode(0, static_cast<int>(_instances.size()));
+    }
+}
+
+// Splits the instances at the median of their centers along the longest axis of the
+// node, which keeps the tree balanced whatever the distribution of the instances
+void Scene::buildNode(const int begin, const int end) {
+    const int index = static_cast<int>(_nodes.size());
+    _nodes.emplace_back();
+    AABB bounds, centers;
+    for (int i = begin; i < end; ++i) {
+        bounds.extend(_instances[_order[i]].bounds);
+        centers.extend(_instances[_order[i]].bounds.center());
+    }
+    _nodes[index].bounds = bounds;
+    if (end - begin <= MaxLeafSize) {
+        _nodes[index].first = begin;
+        _nodes[index].count = end - begin;
+        return;
+    }
+
+    const Vec3 extent = centers.max - centers.min;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    const int middle = begin + (end - begin) / 2;
+    std::nth_element(_order.begin() + begin, _order.begin() + middle, _order.begin() + end, [&](const int a, const int b) {
+        return _instances[a].bounds.center()[axis] < _instances[b].bounds.center()[axis];
+    });
+    buildNode(begin, middle);
+    _nodes[index].first = static_cast<int>(_nodes.size());
+    buildNode(middle, end);
+}
+
+const Model& Scene::getMesh(const int mesh, const int lod) const {
+    return _meshes[mesh][lod].model;
+}
+
+const Meshlets& Scene::getMeshlets(const int mesh, const int lod) const {
+    return _meshes[mesh][lod].meshlets;
+}
+
+int Scene::lodCount(const int mesh) const {
+    return static_cast<int>(_meshes[mesh].size());
+}
+
+Real Scene::getLodError(const int mesh, const int lod) const {
+    return _meshes[mesh][lod].error;
+}
+
+const std::string& Scene::getMeshName(const int mesh) const {
+    return _meshNames[mesh];
+}
+
+int Scene::meshCount() const {
+    return static_cast<int>(_meshes.size());
+}
+
+std::span<const Instance> Scene::getInstances() const {
+    return _instances;
+}
+
+AABB Scene::getBounds() const {
+    return _nodes.empty() ? AABB{} : _nodes.front().bounds;
+}
+
+void Scene::cull(const Matrix<4, 4>& view_projection, const int width, const int height, std::vector<int>& visible) const {
+    visible.clear();
+    if (_nodes.empty()) {
+        return;
+    }
+    Vec4 planes[FrustumPlaneCount];
+    frustumPlanes(view_projection, width, height, planes);
+    const auto outside = [&](const AABB& bounds) {
+        return std::any_of(planes, planes + FrustumPlaneCount, [&](const Vec4& plane) { return bounds.outside(plane); });
+    };
+
+    std::pmr::vector<int> stack(1, 0, &frameArena());
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.back()];
+        const int index = stack.back();
+        stack.pop_back();
+        if (outside(node.bounds)) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack.push_back(node.first);
+            stack.push_back(index + 1);
+            continue;
+        }
+        for (int i = node.first; i < node.first + node.count; ++i) {
+            if (node.count == 1 || !outside(_instances[_order[i]].bounds)) {
+                visible.push_back(_order[i]);
+            }
+        }
+    }
+    std::sort(visible.begin(), visible.end());
+}
+
+int Scene::selectLod(const int instance, const Matrix<4, 4>& view_projection, const Real max_pixels) const {
+    const Instance& placed = _instances[instance];
+    const std::vector<Lod>& lods = _meshes[placed.mesh];
+    // An object-space length l near clip-space w spans about l s / w pixels, where s is
+    // the pixels per unit of clip-space x or y times the length of their object-space
+    // gradient, which includes the scale of the instance
+    const Matrix<4, 4> transform = view_projection * placed.transform;
+    Real scale = 0;
+    for (int i = 0; i < 2; ++i) {
+        scale = std::max(scale, std::abs(Viewport[i][i]) * norm(transform[i].xyz()));
+    }
+    // w is affine in the world-space position, least at a corner of the bounds
+    const Vec4& w_row = view_projection[3];
+    Real w = w_row.w;
+    for (int axis = 0; axis < 3; ++axis) {
+        w += w_row[axis] * (w_row[axis] > 0 ? placed.bounds.min[axis] : placed.bounds.max[axis]);
+    }
+    if (w <= 0) {
+        return 0;
+    }
+    int lod = 0;
+    while (lod + 1 < static_cast<int>(lods.size()) && lods[lod + 1].error * scale <= max_pixels * w) {
+        ++lod;
+    }
+    return lod;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "aabb.h"
+#include "matrix.h"
+#include "meshlet.h"
+#include "model.h"
+
+#include <deque>
+#include <span>
+#include <string>
+#include <vector>
+
+// One placement of a mesh of a Scene
+struct Instance {
+    int mesh = 0;
+    Matrix<4, 4> transform; // from object to world space
+    AABB bounds;            // world-space bounds
+};
+
+// Meshes shared by any number of instances, with a bounding volume hierarchy over the
+// world-space bounds of the instances to cull them against the view frustum. An
+// instance only stores a mesh index and a transform, so memory grows with the number of
+// unique meshes and culling time with the number of visible instances. Every mesh is
+// also split into Meshlets when it is added, to cull its faces in bulk, and can get a
+// chain of simplified levels of detail to draw far instances with fewer faces.
+class Scene {
+public:
+    // Loads obj/<file_name> unless the scene already has it, returns its mesh index or -1
+    int addMesh(const std::string& file_name);
+    // Whether the meshes added from now on are optimized at load (see Model::optimize())
+    void setOptimizeMeshes(const bool optimize);
+    // Whether the meshes added from now on get levels of detail, each simplified to about
+    // half the faces of the previous one (see Model::simplified()), as long as that still
+    // removes a quarter of them
+    void setGenerateLods(const bool generate);
+    // Returns the index of the new instance. The hierarchy must be rebuilt before culling.
+    int addInstance(const int mesh, const Matrix<4, 4>& transform);
+    // Builds the hierarchy over the instances added so far
+    void build();
+
+    // Level of detail lod of a mesh, 0 being the mesh as loaded
+    const Model& getMesh(const int mesh, const int lod = 0) const;
+    const Meshlets& getMeshlets(const int mesh, const int lod = 0) const;
+    int lodCount(const int mesh) const;
+    // Object-space simplification error of a level of detail of a mesh
+    Real getLodError(const int mesh, const int lod) const;
+    const std::string& getMeshName(const int mesh) const;
+    int meshCount() const;
+    std::span<const Instance> getInstances() const;
+    // World-space bounds of all the instances, as of the last build()
+    AABB getBounds() const;
+
+    // Fills visible with the indices, in increasing order, of the instances whose bounds
+    // are at least partly inside the view region of frustumPlanes(view_projection, ...)
+    void cull(const Matrix<4, 4>& view_projection, const int width, const int height, std::vector<int>& visible) const;
+    // Coarsest level of detail of the mesh of an instance whose error, projected by
+    // view_projection and Viewport at the point of the instance's bounds nearest the eye,
+    // spans at most max_pixels pixels
+    int selectLod(const int instance, const Matrix<4, 4>& view_projection, const Real max_pixels) const;
+
+private:
+    // Leaves cover instances _order[first, first + count). Inner nodes have count 0,
+    // their left child follows them and their right child is at index first.
+    struct Node {
+        AABB bounds;
+        int first = 0;
+        int count = 0;
+    };
+
+    struct Lod {
+        Model model;
+        Meshlets meshlets;
+        Real error = 0;
+    };
+
+    void buildNode(const int begin, const int end);
+
+    std::deque<std::vector<Lod>> _meshes; // a deque never moves the meshes it already holds
+    std::vector<std::string> _meshNames;
+    std::vector<Instance> _instances;
+    std::vector<int> _order;
+    std::vector<Node> _nodes;
+    bool _optimizeMeshes = false;
+    bool _generateLods = false;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "gl.h"
+#include "matrix.h"
+#include "model.h"
+#include "shadow.h"
+#include "texture.h"
+#include "tgaimage.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+// Colour added to every lit pixel, so faces turned away from the light are not pitch black
+constexpr Real Ambient = 5;
+// Weight of the specular highlight relative to the diffuse term
+constexpr Real SpecularWeight = 0.6;
+
+inline TGAColor scale(const TGAColor& color, const Real intensity) {
+    TGAColor ret = color;
+    for (int c = 0; c < 3; ++c) {
+        ret[c] = static_cast<std::uint8_t>(std::clamp(color.bgra[c] * intensity, Real{0}, Real{255}));
+    }
+    return ret;
+}
+
+// Phong reflection of albedo for the eye-space unit normal n and direction to the light
+// l, with the viewer looking down -z
+inline TGAColor phong(const TGAColor& albedo, const Vec3& n, const Vec3& l, const Real shininess) {
+    const Real diffuse = std::max(Real{0}, n * l);
+    const Vec3 r = normalized(n * (2 * (n * l)) - l);
+    const Real specular = std::pow(std::max(r.z, Real{0}), shininess);
+    TGAColor ret = albedo;
+    for (int c = 0; c < 3; ++c) {
+        ret[c] = static_cast<std::uint8_t>(std::min(Ambient + albedo.bgra[c] * (diffuse + SpecularWeight * specular), Real{255}));
+    }
+    return ret;
+}
+
+// State shared by the shaders below: the model and the camera and light at the time
+// the shader is constructed, with everything expressed in eye space.
+struct LitShader {
+    LitShader(const Model& model, const Vec3& light)
+        : model(model),
+          modelview(Modelview),
+          normal_matrix(Modelview.invertTranspose()),
+          light(normalized((Modelview * Vec4{light.x, light.y, light.z, 0.}).xyz())) {
+    }
+
+    Vec3 position(const int face, const int corner) const {
+        const Vec3& v = model.getVertices()[model.getVertexFaces()[face][corner]];
+        return (modelview * Vec4{v.x, v.y, v.z, 1.}).xyz();
+    }
+
+    Vec3 faceNormal(const int face) const {
+        const Vec3 p0 = position(face, 0);
+        return normalized(cross(position(face, 1) - p0, position(face, 2) - p0));
+    }
+
+    // Falls back to the face normal for corners without one
+    Vec3 normal(const int face, const int corner) const {
+        const int index = model.getNormalFaces()[face][corner];
+        if (index < 0) {
+            return faceNormal(face);
+        }
+        const Vec3& n = model.getNormals()[index];
+        return normalized((normal_matrix * Vec4{n.x, n.y, n.z, 0.}).xyz());
+    }
+
+    Vec2 uv(const int face, const int corner) const {
+        const int index = model.getUVFaces()[face][corner];
+        return index < 0 ? Vec2{} : model.getUVs()[index];
+    }
+
+    const Model& model;
+    Matrix<4, 4> modelview;
+    Matrix<4, 4> normal_matrix;
+    Vec3 light;
+};
+
+// count random colours for FlatShader. The same seed gives the same colours on every
+// platform, as the raw generator output is used rather than a distribution.
+inline std::vector<TGAColor> randomColors(const std::size_t count, const std::uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::vector<TGAColor> colors(count);
+    for (TGAColor& color : colors) {
+        for (int c = 0; c < 3; ++c) {
+            color[c] = static_cast<std::uint8_t>(generator() % 255);
+        }
+    }
+    return colors;
+}
+
+// One colour per face, lit by the geometric normal of the face
+struct FlatShader : LitShader {
+    struct Varyings {
+        Vec3 color;
+    };
+
+    FlatShader(const Model& model, const Vec3& light, std::span<const TGAColor> face_colors)
+        : LitShader(model, light), face_colors(face_colors) {
+    }
+
+    Varyings vertex(const int face, const int) const {
+        const TGAColor& c = face_colors[face];
+        const Real intensity = std::max(Real{0}, faceNormal(face) * light);
+        return {Vec3{c.bgra[0] * intensity, c.bgra[1] * intensity, c.bgra[2] * intensity}};
+    }
+
+    TGAColor fragment(const Varyings& in) const {
+        TGAColor ret;
+        for (int c = 0; c < 3; ++c) {
+            ret[c] = static_cast<std::uint8_t>(std::clamp(Ambient + in.color[c], Real{0}, Real{255}));
+        }
+        return ret;
+    }
+
+    std::span<const TGAColor> face_colors;
+};
+
+// Diffuse lighting evaluated at the vertices and interpolated across the face
+struct GouraudShader : LitShader {
+    struct Varyings {
+        Vec2 uv;
+        Real intensity;
+    };
+
+    GouraudShader(const Model& model, const Vec3& light, const Texture& diffuse)
+        : LitShader(model, light), diffuse(diffuse) {
+    }
+
+    Varyings vertex(const int face, const int corner) const {
+        return {uv(face, corner), std::max(Real{0}, normal(face, corner) * light)};
+    }
+
+    TGAColor fragment(const Varyings& in, const Varyings& ddx, const Varyings& ddy) const {
+        return scale(diffuse.sample(in.uv, ddx.uv, ddy.uv), in.intensity);
+    }
+
+    const Texture& diffuse;
+};
+
+// Per-pixel Phong lighting of the interpolated vertex normal, with the specular
+// exponent read from the specular map
+struct PhongShader : LitShader {
+    struct Varyings {
+        Vec3 normal;
+        Vec2 uv;
+    };
+
+    PhongShader(const Model& model, const Vec3& light, const Texture& diffuse, const Texture& specular)
+        : LitShader(model, light), diffuse(diffuse), specular(specular) {
+    }
+
+    Varyings vertex(const int face, const int corner) const {
+        return {normal(face, corner), uv(face, corner)};
+    }
+
+    TGAColor fragment(const Varyings& in, const Varyings& ddx, const Varyings& ddy) const {
+        return phong(diffuse.sample(in.uv, ddx.uv, ddy.uv), normalized(in.normal), light, 5 + specular.sample(in.uv, ddx.uv, ddy.uv).bgra[0]);
+    }
+
+    const Texture& diffuse;
+    const Texture& specular;
+};
+
+// Phong lighting of a normal read from a tangent-space normal map. The tangent frame is
+// derived per face from the positions and texture coordinates of its corners.
+struct NormalMapShader : LitShader {
+    struct Varyings {
+        Vec3 normal;
+        Vec2 uv;
+        Vec3 tangent;
+        Vec3 bitangent;
+    };
+
+    NormalMapShader(const Model& model, const Vec3& light, const Texture& diffuse, const Texture& normal_map, const Texture& specular)
+        : LitShader(model, light), diffuse(diffuse), normal_map(normal_map), specular(specular) {
+    }
+
+    Varyings vertex(const int face, const int corner) const {
+        const Vec3 p0 = position(face, 0);
+        const Vec3 e1 = position(face, 1) - p0;
+        const Vec3 e2 = position(face, 2) - p0;
+        const Vec2 uv0 = uv(face, 0);
+        const Vec2 d1 = uv(face, 1) - uv0;
+        const Vec2 d2 = uv(face, 2) - uv0;
+        const Real det = d1.x * d2.y - d2.x * d1.y;
+        const Real inv_det = std::abs(det) > Real{1e-12} ? 1 / det : 0;
+        return {normal(face, corner), uv(face, corner), (e1 * d2.y - e2 * d1.y) * inv_det, (e2 * d1.x - e1 * d2.x) * inv_det};
+    }
+
+    TGAColor fragment(const Varyings& in, const Varyings& ddx, const Varyings& ddy) const {
+        const Vec3 n = normalized(in.normal);
+        const TGAColor albedo = diffuse.sample(in.uv, ddx.uv, ddy.uv);
+        const Real shininess = 5 + specular.sample(in.uv, ddx.uv, ddy.uv).bgra[0];
+        if (in.tangent * in.tangent == 0) {
+            return phong(albedo, n, light, shininess); // degenerate texture mapping
+        }
+        // Gram-Schmidt keeps the interpolated frame orthonormal
+        const Vec3 t = normalized(in.tangent - n * (n * in.tangent));
+        const Vec3 b = normalized(in.bitangent - n * (n * in.bitangent) - t * (t * in.bitangent));
+        const TGAColor c = normal_map.sample(in.uv, ddx.uv, ddy.uv);
+        const Vec3 m{c.bgra[2] / Real{127.5} - 1, c.bgra[1] / Real{127.5} - 1, c.bgra[0] / Real{127.5} - 1};
+        const Vec3 mapped = normalized(t * m.x + b * m.y + n * m.z);
+        return phong(albedo, mapped, light, shininess);
+    }
+
+    const Texture& diffuse;
+    const Texture& normal_map;
+    const Texture& specular;
+};
+
+// shader with the light it reflects attenuated by a shadow map, by scaling everything
+// above the ambient term with the lit fraction of the pixel. transform maps the object
+// space of the model to the clip space of the light, e.g. shadow.viewProjection() times
+// the transform of the instance; the position there is interpolated like the other
+// varyings.
+template <ShaderType Shader>
+struct ShadowedShader : Shader {
+    struct Varyings {
+        typename Shader::Varyings base;
+        Vec4 light_position;
+    };
+
+    ShadowedShader(const Shader& shader, const ShadowMap& shadow, const Matrix<4, 4>& transform)
+        : Shader(shader), shadow(shadow), transform(transform) {
+    }
+
+    Varyings vertex(const int face, const int corner) const {
+        const Vec3& v = this->model.getVertices()[this->model.getVertexFaces()[face][corner]];
+        return {Shader::vertex(face, corner), transform * Vec4{v.x, v.y, v.z, 1.}};
+    }
+
+    TGAColor fragment(const Varyings& in) const
+        requires(!ShaderWithDerivatives<Shader>)
+    {
+        return shadowed(Shader::fragment(in.base), in.light_position);
+    }
+
+    TGAColor fragment(const Varyings& in, const Varyings& ddx, const Varyings& ddy) const
+        requires ShaderWithDerivatives<Shader>
+    {
+        return shadowed(Shader::fragment(in.base, ddx.base, ddy.base), in.light_position);
+    }
+
+    TGAColor shadowed(const TGAColor& color, const Vec4& light_position) const {
+        const Real lit = shadow.lit(light_position);
+        if (lit == 1) {
+            return color;
+        }
+        TGAColor ret = color;
+        for (int c = 0; c < 3; ++c) {
+            ret[c] = static_cast<std::uint8_t>(std::min(Ambient + (color.bgra[c] - Ambient) * lit, static_cast<Real>(color.bgra[c])));
+        }
+        return ret;
+    }
+
+    const ShadowMap& shadow;
+    Matrix<4, 4> transform;
+};
+
+// shader drawing a subset of the faces of its model, e.g. those of the visible meshlets:
+// face i of the draw is face face_ids[i] of the model
+template <ShaderType Shader>
+struct FaceSubsetShader : Shader {
+    FaceSubsetShader(const Shader& shader, std::span<const int> face_ids)
+        : Shader(shader), face_ids(face_ids) {
+    }
+
+    typename Shader::Varyings vertex(const int face, const int corner) const {
+        return Shader::vertex(face_ids[face], corner);
+    }
+
+    std::span<const int> face_ids;
+};
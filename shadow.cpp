@@ -0,0 +1,98 @@
+#include "shadow.h"
+
+#include "model.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Focal length of the light in radii of the scene. perspective() puts the light that far
+// from the center, where the directions to the points of the scene differ by less than
+// a degree, so the shadows agree with the directional light of the shaders.
+constexpr Real LightFocal = 64;
+// Depth offset of lit(), in texels of the map beyond the filter radius: a receiver is
+// compared with texels up to radius away, which a sloped surface puts at other depths
+constexpr Real BiasTexels = 1.5;
+
+}
+
+ShadowMap::ShadowMap(const int size, const int radius)
+    : _size(size), _radius(radius), _depth(size, size) {
+}
+
+void ShadowMap::render(const Scene& scene, const Vec3& light) {
+    PROFILE_SCOPE("shadow");
+    const Matrix<4, 4> modelview = Modelview;
+    const Matrix<4, 4> projection = Perspective;
+    const Matrix<4, 4> screen = Viewport;
+
+    const AABB bounds = scene.getBounds();
+    const Vec3 center = bounds.empty() ? Vec3{} : bounds.center();
+    const Real radius = bounds.empty() ? 1 : std::max(norm(bounds.max - center), Real{1e-6});
+    const Vec3 direction = normalized(light);
+    // lookAt() needs an up vector that is not parallel to the view direction
+    lookAt(center + direction, center, std::abs(direction.y) < Real{0.99} ? Vec3{0, 1, 0} : Vec3{0, 0, 1});
+    // The scene is scaled to the unit sphere, so the map frames it like the default camera
+    // frames the head
+    const Real scale = 1 / radius;
+    Modelview = Matrix<4, 4>{{{scale, 0, 0, 0}, {0, scale, 0, 0}, {0, 0, scale, 0}, {0, 0, 0, 1}}} * Modelview;
+    perspective(LightFocal);
+    viewport(_size / 16, _size / 16, _size * 7 / 8, _size * 7 / 8);
+    _viewProjection = Perspective * Modelview;
+    _viewport = Viewport;
+    // Near the unit sphere w is close to 1, so a texel spans about 2 / (7 / 8 size) in
+    // depth units too
+    _bias = (BiasTexels + _radius) * 16 / (7 * Real(_size));
+
+    _depth.clear();
+    std::vector<int> visible, vertices, face_ids;
+    std::vector<Face> faces;
+    for (const Instance& instance : scene.getInstances()) {
+        const Matrix<4, 4> transform = _viewProjection * instance.transform;
+        const Meshlets& meshlets = scene.getMeshlets(instance.mesh);
+        meshlets.cull(transform, _size, _size, visible);
+        meshlets.gather(visible, vertices, faces, face_ids);
+        transformVertices(transform, scene.getMesh(instance.mesh).getVertices(), vertices, _clip);
+        drawDepth(_clip, faces, _depth);
+    }
+
+    Modelview = modelview;
+    Perspective = projection;
+    Viewport = screen;
+}
+
+const Matrix<4, 4>& ShadowMap::viewProjection() const {
+    return _viewProjection;
+}
+
+Real ShadowMap::lit(const Vec4& p) const {
+    if (!(p.w > 0)) {
+        return 1;
+    }
+    const Vec4 ndc = p / p.w;
+    const Vec4 texel = _viewport * ndc;
+    // Texel centers are at integer positions, like the pixel positions of the rasterizer
+    if (!(texel.x > Real{-0.5} && texel.x < _size - Real{0.5} && texel.y > Real{-0.5} && texel.y < _size - Real{0.5})) {
+        return 1;
+    }
+    const int x = static_cast<int>(std::lround(texel.x));
+    const int y = static_cast<int>(std::lround(texel.y));
+    const Real depth = ndc.z + _bias;
+    // Texels beyond the edges of the map repeat those on the edges
+    int count = 0;
+    for (int dy = -_radius; dy <= _radius; ++dy) {
+        const int ty = std::clamp(y + dy, 0, _size - 1);
+        for (int dx = -_radius; dx <= _radius; ++dx) {
+            count += depth >= _depth.get(std::clamp(x + dx, 0, _size - 1), ty);
+        }
+    }
+    const int side = 2 * _radius + 1;
+    return static_cast<Real>(count) / (side * side);
+}
+
+const ZBuffer& ShadowMap::depth() const {
+    return _depth;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "gl.h"
+#include "matrix.h"
+#include "scene.h"
+#include "vector.h"
+#include "zbuffer.h"
+
+// Depth of a scene seen from a directional light, rendered with drawDepth(). The light
+// looks at the scene from the given direction through lookAt() and perspective(), with
+// a focal length long enough for its rays to be nearly parallel, and the map frames the
+// bounds of the whole scene. lit() filters the depth test over the texels around a
+// point (percentage-closer filtering), which softens the edges of the shadows.
+class ShadowMap {
+public:
+    ShadowMap() = default;
+    // A size x size map, filtered over (2 * radius + 1)^2 texels
+    ShadowMap(const int size, const int radius);
+
+    // Renders every instance of scene, light being the direction towards the light. The
+    // Modelview, Perspective and Viewport of gl.h are restored afterwards.
+    void render(const Scene& scene, const Vec3& light);
+
+    // Transform from world space to the clip space of the light, as of the last render()
+    const Matrix<4, 4>& viewProjection() const;
+    // Fraction of the filtered texels that see the point at the light's clip position
+    // p, 1 for points outside the map
+    Real lit(const Vec4& p) const;
+    const ZBuffer& depth() const;
+
+private:
+    int _size = 0;
+    int _radius = 0;
+    // Depth offset keeping surfaces from shadowing themselves, in the depth units of the
+    // map, which scale with the scene
+    Real _bias = 0;
+    Matrix<4, 4> _viewProjection;
+    Matrix<4, 4> _viewport;
+    ZBuffer _depth;
+    ClipBuffer _clip;
+};
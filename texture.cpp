@@ -0,0 +1,174 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+std::uint32_t pack(const TGAColor& c) {
+    if (c.bytespp == TGAImage::GRAYSCALE) {
+        return c.bgra[0] * 0x010101u | 0xff000000u;
+    }
+    const std::uint32_t alpha = c.bytespp == TGAImage::RGBA ? c.bgra[3] : 0xff;
+    return c.bgra[0] | c.bgra[1] << 8 | c.bgra[2] << 16 | alpha << 24;
+}
+
+std::uint32_t channel(const std::uint32_t texel, const int c) {
+    return (texel >> (8 * c)) & 0xff;
+}
+
+// Box-filters a row-major w x h level down to the next one
+std::vector<std::uint32_t> downsample(const std::vector<std::uint32_t>& src, const int w, const int h, const int next_w, const int next_h) {
+    std::vector<std::uint32_t> dst(static_cast<std::size_t>(next_w) * next_h);
+    for (int y = 0; y < next_h; ++y) {
+        const int y0 = std::min(2 * y, h - 1);
+        const int y1 = std::min(2 * y + 1, h - 1);
+        for (int x = 0; x < next_w; ++x) {
+            const int x0 = std::min(2 * x, w - 1);
+            const int x1 = std::min(2 * x + 1, w - 1);
+            const std::uint32_t quad[4] = {src[y0 * w + x0], src[y0 * w + x1], src[y1 * w + x0], src[y1 * w + x1]};
+            std::uint32_t texel = 0;
+            for (int c = 0; c < 4; ++c) {
+                const std::uint32_t sum = channel(quad[0], c) + channel(quad[1], c) + channel(quad[2], c) + channel(quad[3], c);
+                texel |= ((sum + 2) / 4) << (8 * c);
+            }
+            dst[y * next_w + x] = texel;
+        }
+    }
+    return dst;
+}
+
+}
+
+Texture::Texture(const TGAImage& image, const Filter filter)
+    : _filter(filter) {
+    int w = image.width();
+    int h = image.height();
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    std::size_t size = 0;
+    for (int lw = w, lh = h;; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2)) {
+        const int blocks_x = (lw + 3) / 4;
+        _levels.push_back({lw, lh, blocks_x, size});
+        size += static_cast<std::size_t>(blocks_x) * ((lh + 3) / 4) * 16;
+        if (lw == 1 && lh == 1) {
+            break;
+        }
+    }
+    _texels.resize(size);
+
+    // Each level is built row-major from the previous one and then scattered into blocks
+    std::vector<std::uint32_t> linear(static_cast<std::size_t>(w) * h);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            linear[y * w + x] = pack(image.get(x, y));
+        }
+    }
+    for (std::size_t l = 0; l < _levels.size(); ++l) {
+        const Level& level = _levels[l];
+        for (int y = 0; y < level.height; ++y) {
+            for (int x = 0; x < level.width; ++x) {
+                const std::size_t block = static_cast<std::size_t>(y >> 2) * level.blocks_x + (x >> 2);
+                _texels[level.offset + block * 16 + ((y & 3) << 2) + (x & 3)] = linear[y * level.width + x];
+            }
+        }
+        if (l + 1 < _levels.size()) {
+            linear = downsample(linear, level.width, level.height, _levels[l + 1].width, _levels[l + 1].height);
+        }
+    }
+}
+
+TGAColor Texture::sample(const Vec2& uv) const {
+    return sampleLod(uv, 0);
+}
+
+TGAColor Texture::sample(const Vec2& uv, const Vec2& duvdx, const Vec2& duvdy) const {
+    if (_levels.empty()) {
+        return {};
+    }
+    // Texels covered by a pixel step along x and along y, the larger one sets the level
+    const Real w = _levels[0].width;
+    const Real h = _levels[0].height;
+    const Real rho = std::max(std::hypot(duvdx.x * w, duvdx.y * h), std::hypot(duvdy.x * w, duvdy.y * h));
+    return sampleLod(uv, rho > 1 ? std::log2(rho) : 0);
+}
+
+int Texture::width() const {
+    return _levels.empty() ? 0 : _levels[0].width;
+}
+
+int Texture::height() const {
+    return _levels.empty() ? 0 : _levels[0].height;
+}
+
+int Texture::levels() const {
+    return static_cast<int>(_levels.size());
+}
+
+std::uint32_t Texture::texel(const Level& level, const int x, const int y) const {
+    const std::size_t block = static_cast<std::size_t>(y >> 2) * level.blocks_x + (x >> 2);
+    return _texels[level.offset + block * 16 + ((y & 3) << 2) + (x & 3)];
+}
+
+void Texture::sampleLevel(const int l, const Vec2& uv, Real out[4]) const {
+    const Level& level = _levels[l];
+    // Texture rows are stored top first while v points up
+    const Real x = uv.x * level.width;
+    const Real y = (1 - uv.y) * level.height;
+    if (_filter == Filter::Nearest) {
+        const std::uint32_t t = texel(level,
+                                      std::clamp(static_cast<int>(std::floor(x)), 0, level.width - 1),
+                                      std::clamp(static_cast<int>(std::floor(y)), 0, level.height - 1));
+        for (int c = 0; c < 4; ++c) {
+            out[c] = channel(t, c);
+        }
+        return;
+    }
+
+    const Real fx = std::floor(x - Real{0.5});
+    const Real fy = std::floor(y - Real{0.5});
+    const Real ax = x - Real{0.5} - fx;
+    const Real ay = y - Real{0.5} - fy;
+    const int x0 = std::clamp(static_cast<int>(fx), 0, level.width - 1);
+    const int x1 = std::clamp(static_cast<int>(fx) + 1, 0, level.width - 1);
+    const int y0 = std::clamp(static_cast<int>(fy), 0, level.height - 1);
+    const int y1 = std::clamp(static_cast<int>(fy) + 1, 0, level.height - 1);
+    const std::uint32_t t00 = texel(level, x0, y0);
+    const std::uint32_t t10 = texel(level, x1, y0);
+    const std::uint32_t t01 = texel(level, x0, y1);
+    const std::uint32_t t11 = texel(level, x1, y1);
+    for (int c = 0; c < 4; ++c) {
+        const Real top = channel(t00, c) + (static_cast<Real>(channel(t10, c)) - channel(t00, c)) * ax;
+        const Real bottom = channel(t01, c) + (static_cast<Real>(channel(t11, c)) - channel(t01, c)) * ax;
+        out[c] = top + (bottom - top) * ay;
+    }
+}
+
+TGAColor Texture::sampleLod(const Vec2& uv, Real lod) const {
+    if (_levels.empty()) {
+        return {};
+    }
+    lod = std::clamp(lod, Real{0}, static_cast<Real>(_levels.size() - 1));
+    Real c[4];
+    if (_filter == Filter::Trilinear) {
+        const int l0 = static_cast<int>(lod);
+        const Real t = lod - l0;
+        sampleLevel(l0, uv, c);
+        if (t > 0) {
+            Real c1[4];
+            sampleLevel(l0 + 1, uv, c1);
+            for (int i = 0; i < 4; ++i) {
+                c[i] += (c1[i] - c[i]) * t;
+            }
+        }
+    } else {
+        sampleLevel(static_cast<int>(std::lround(lod)), uv, c);
+    }
+    TGAColor ret;
+    for (int i = 0; i < 4; ++i) {
+        ret.bgra[i] = static_cast<std::uint8_t>(std::clamp(c[i] + Real{0.5}, Real{0}, Real{255}));
+    }
+    return ret;
+}
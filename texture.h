@@ -0,0 +1,50 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "tgaimage.h"
+#include "vector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A read-only, mipmapped copy of a TGAImage prepared for sampling. Texels are stored as
+// 32-bit BGRA in 4x4 blocks of one cache line each, so the footprint of a filtered
+// lookup touches one or two lines instead of up to four rows of the image.
+class Texture {
+public:
+    enum class Filter {
+        Nearest,   // nearest texel of the nearest mip level
+        Bilinear,  // bilinear within the nearest mip level
+        Trilinear, // bilinear within the two nearest mip levels, blended
+    };
+
+    Texture() = default;
+    // image must be top row first, as loaded by read_tga_file
+    explicit Texture(const TGAImage& image, const Filter filter = Filter::Trilinear);
+
+    // Samples the full resolution level at uv (v up, clamped to the edges)
+    TGAColor sample(const Vec2& uv) const;
+    // Samples at uv with the mip level chosen from the screen-space derivatives of uv
+    TGAColor sample(const Vec2& uv, const Vec2& duvdx, const Vec2& duvdy) const;
+
+    int width() const;
+    int height() const;
+    int levels() const;
+
+private:
+    struct Level {
+        int width = 0;
+        int height = 0;
+        int blocks_x = 0;
+        std::size_t offset = 0; // of the first block in _texels
+    };
+
+    std::uint32_t texel(const Level& level, const int x, const int y) const;
+    void sampleLevel(const int level, const Vec2& uv, Real out[4]) const;
+    TGAColor sampleLod(const Vec2& uv, const Real lod) const;
+
+    Filter _filter = Filter::Trilinear;
+    std::vector<Level> _levels;
+    std::vector<std::uint32_t, AlignedAllocator<std::uint32_t, CacheLineSize>> _texels;
+};
@@ -1,25 +1,113 @@
 #include "tgaimage.h"
 
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory_resource>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Raw bytes per band of rows the RLE encoder hands to one thread
+constexpr int RleBandBytes = 1 << 16;
+
+// Bit mask of the bytes i of p[0, 16) equal to p[i + bpp]
+#if defined(__SSE2__)
+std::uint32_t equalToNext(const std::uint8_t* p, const int bpp) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + bpp));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+}
+#else
+std::uint32_t equalToNext(const std::uint8_t* p, const int bpp) {
+    std::uint32_t mask = 0;
+    for (int i = 0; i < 16; ++i) {
+        mask |= static_cast<std::uint32_t>(p[i] == p[i + bpp]) << i;
+    }
+    return mask;
+}
+#endif
+
+// Number of pixels, from 1 to limit, that repeat the first pixel at p. A pixel repeats
+// its predecessor when each of its bytes equals the byte bpp before, so the run ends at
+// the first byte differing from the byte bpp after it, found 16 bytes at a time.
+int runLength(const std::uint8_t* p, const int limit, const int bpp) {
+    const int nbytes = (limit - 1) * bpp;
+    int i = 0;
+    for (; i + 16 <= nbytes; i += 16) {
+        const std::uint32_t mask = equalToNext(p + i, bpp);
+        if (mask != 0xffff) {
+            return (i + std::countr_one(mask)) / bpp + 1;
+        }
+    }
+    for (; i < nbytes && p[i] == p[i + bpp]; ++i) {
+    }
+    return i / bpp + 1;
+}
+
+// Number of pixels, from 1 to limit, before the first pixel at p that equals its
+// successor, which starts the next run. In the byte mask of equalToNext() such a pixel
+// is bpp set bits starting at a multiple of bpp.
+int rawLength(const std::uint8_t* p, const int limit, const int bpp) {
+    const int step = 16 / bpp; // pixels whose bytes all fall in one mask
+    std::uint32_t pixel_bits = 0;
+    for (int k = 0; k < step; ++k) {
+        pixel_bits |= 1u << (k * bpp);
+    }
+    int pixel = 1;
+    // The last pixel has no successor within the limit to start a run with
+    for (; (pixel + 1) * bpp + 16 <= limit * bpp; pixel += step) {
+        const std::uint32_t mask = equalToNext(p + pixel * bpp, bpp);
+        std::uint32_t equal = mask & pixel_bits;
+        for (int b = 1; b < bpp; ++b) {
+            equal &= mask >> b;
+        }
+        if (equal) {
+            return pixel + std::countr_zero(equal) / bpp;
+        }
+    }
+    for (; pixel < limit - 1; ++pixel) {
+        if (std::memcmp(p + pixel * bpp, p + (pixel + 1) * bpp, bpp) == 0) {
+            return pixel;
+        }
+    }
+    return limit;
+}
+
+}
 
 TGAImage::TGAImage(const int w, const int h, const int bpp)
     : w(w), h(h), bpp(bpp), data(w * h * bpp, 0) {
 }
 
 bool TGAImage::read_tga_file(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
+    const MappedFile file(filename);
+    if (!file.isOpen()) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    if (!decode_tga({reinterpret_cast<const std::uint8_t*>(file.data()), file.size()})) {
+        return false;
+    }
+    std::cerr << w << "x" << h << "/" << bpp * 8 << "\n";
+    return true;
+}
+
+bool TGAImage::decode_tga(std::span<const std::uint8_t> file) {
     TGAHeader header;
-    in.read(reinterpret_cast<char*>(&header), sizeof(header));
-    if (!in.good()) {
+    if (file.size() < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    std::memcpy(&header, file.data(), sizeof(header));
     w = header.width;
     h = header.height;
     bpp = header.bitsperpixel >> 3;
@@ -27,16 +115,17 @@ bool TGAImage::read_tga_file(const std::string filename) {
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
+    const std::span<const std::uint8_t> in = file.subspan(std::min(file.size(), sizeof(header) + header.idlength));
     size_t nbytes = bpp * w * h;
     data = std::vector<std::uint8_t>(nbytes, 0);
     if (3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read(reinterpret_cast<char*>(data.data()), nbytes);
-        if (!in.good()) {
+        if (in.size() < nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        std::memcpy(data.data(), in.data(), nbytes);
     } else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
+        if (!decode_rle_data(in)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
@@ -44,143 +133,169 @@ bool TGAImage::read_tga_file(const std::string filename) {
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
-    if (!(header.imagedescriptor & 0x20))
-        flip_vertically();
-    if (header.imagedescriptor & 0x10)
-        flip_horizontally();
-    std::cerr << w << "x" << h << "/" << bpp * 8 << "\n";
+    vflipped = !(header.imagedescriptor & 0x20);
+    hflipped = header.imagedescriptor & 0x10;
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-    size_t pixelcount = w * h;
-    size_t currentpixel = 0;
-    size_t currentbyte = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
-            std::cerr << "an error occured while reading the data\n";
+bool TGAImage::decode_rle_data(std::span<const std::uint8_t> in) {
+    std::uint8_t* out = data.data();
+    std::uint8_t* const end = out + data.size();
+    const std::uint8_t* p = in.data();
+    const std::uint8_t* const in_end = p + in.size();
+    while (out < end) {
+        if (p == in_end) {
+            return false;
+        }
+        const std::uint8_t chunkheader = *p++;
+        const std::size_t count = (chunkheader & 0x7f) + 1;
+        const std::size_t nbytes = count * bpp;
+        if (nbytes > static_cast<std::size_t>(end - out)) {
+            std::cerr << "Too many pixels read\n";
             return false;
         }
         if (chunkheader < 128) {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++) {
-                in.read(reinterpret_cast<char*>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            if (nbytes > static_cast<std::size_t>(in_end - p)) {
+                return false;
             }
+            std::memcpy(out, p, nbytes);
+            p += nbytes;
         } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char*>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
+            if (static_cast<std::size_t>(bpp) > static_cast<std::size_t>(in_end - p)) {
                 return false;
             }
-            for (int i = 0; i < chunkheader; i++) {
-                for (int t = 0; t < bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            // Repeats the pixel by doubling the copied prefix
+            std::memcpy(out, p, bpp);
+            p += bpp;
+            for (std::size_t copied = bpp; copied < nbytes; copied *= 2) {
+                std::memcpy(out + copied, out, std::min(copied, nbytes - copied));
             }
         }
-    } while (currentpixel < pixelcount);
+        out += nbytes;
+    }
     return true;
 }
 
 bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
-    constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
-    constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
-    constexpr std::uint8_t footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    std::vector<std::uint8_t> file;
+    return write_tga_file(filename, file, vflip, rle);
+}
+
+bool TGAImage::write_tga_file(const std::string& filename, std::vector<std::uint8_t>& file, const bool vflip, const bool rle) const {
+    if (!encode_tga(file, vflip, rle)) {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
+    // The file goes out in one write, past the buffer of the stream, which is given one
+    // so it does not allocate its own
+    char stream_buffer[256];
     std::ofstream out;
+    out.rdbuf()->pubsetbuf(stream_buffer, sizeof(stream_buffer));
     out.open(filename, std::ios::binary);
     if (!out.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    out.write(reinterpret_cast<const char*>(file.data()), file.size());
+    if (!out.good()) {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
+    return true;
+}
+
+bool TGAImage::encode_tga(std::vector<std::uint8_t>& out, const bool vflip, const bool rle) const {
+    constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
+    constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
+    constexpr std::uint8_t footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O', 'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
+    if (data.empty()) {
+        return false;
+    }
     TGAHeader header = {};
     header.bitsperpixel = bpp << 3;
     header.width = w;
     header.height = h;
     header.datatypecode = (bpp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
-    header.imagedescriptor = vflip ? 0x00 : 0x20; // top-left or bottom-left origin
-    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    if (!out.good())
-        goto err;
+    // Bottom-left or top-left origin for the first image row, whichever matches the
+    // stored order, and right-to-left rows when they are stored mirrored
+    header.imagedescriptor = (vflip == vflipped ? 0x20 : 0x00) | (hflipped ? 0x10 : 0x00);
+    const auto append = [&out](const void* bytes, const std::size_t size) {
+        const std::size_t offset = out.size();
+        out.resize(offset + size);
+        std::memcpy(out.data() + offset, bytes, size);
+    };
+
+    out.clear();
+    append(&header, sizeof(header));
     if (!rle) {
-        out.write(reinterpret_cast<const char*>(data.data()), w * h * bpp);
-        if (!out.good())
-            goto err;
-    } else if (!unload_rle_data(out))
-        goto err;
-    out.write(reinterpret_cast<const char*>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good())
-        goto err;
-    out.write(reinterpret_cast<const char*>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good())
-        goto err;
-    out.write(reinterpret_cast<const char*>(footer), sizeof(footer));
-    if (!out.good())
-        goto err;
+        append(data.data(), data.size());
+    } else {
+        // Bands of rows are encoded independently, in parallel, and concatenated. No
+        // packet crosses a band boundary, so the result is a valid stream whatever the
+        // number of threads, and always the same one. Every band is encoded into out
+        // where its worst case would start, and then moved down behind the previous one.
+        const int band_rows = std::max(1, RleBandBytes / (w * bpp));
+        const int num_bands = (h + band_rows - 1) / band_rows;
+        const std::size_t band_capacity = static_cast<std::size_t>(band_rows) * w * (bpp + 1);
+        const std::size_t start = out.size();
+        out.resize(start + band_capacity * num_bands + sizeof(developer_area_ref) + sizeof(extension_area_ref) + sizeof(footer));
+        // The sizes of the bands of an image up to 16 MB fit on the stack
+        std::byte sizes_buffer[256 * sizeof(std::size_t)];
+        std::pmr::monotonic_buffer_resource sizes_resource(sizes_buffer, sizeof(sizes_buffer));
+        std::pmr::vector<std::size_t> sizes(num_bands, &sizes_resource);
+        std::uint8_t* const bands = out.data() + start;
+#pragma omp parallel for schedule(dynamic)
+        for (int band = 0; band < num_bands; ++band) {
+            sizes[band] = encode_rle_rows(band * band_rows, std::min(h, (band + 1) * band_rows), bands + band * band_capacity);
+        }
+        std::size_t size = sizes[0];
+        for (int band = 1; band < num_bands; ++band) {
+            std::memmove(bands + size, bands + band * band_capacity, sizes[band]);
+            size += sizes[band];
+        }
+        out.resize(start + size);
+    }
+    append(developer_area_ref, sizeof(developer_area_ref));
+    append(extension_area_ref, sizeof(extension_area_ref));
+    append(footer, sizeof(footer));
     return true;
-err:
-    std::cerr << "can't dump the tga file\n";
-    return false;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream& out) const {
-    const std::uint8_t max_chunk_length = 128;
-    size_t npixels = w * h;
-    size_t curpix = 0;
+// Encodes the pixels of rows [y0, y1) as RLE packets into out: a run packet for every
+// pixel repeated at least twice and raw packets for the pixels in between, at most 128
+// pixels each. Returns the size of the packets, which is at most a header for every
+// pixel, (y1 - y0) * width * (bytespp + 1) bytes.
+std::size_t TGAImage::encode_rle_rows(const int y0, const int y1, std::uint8_t* const out) const {
+    constexpr int max_chunk_length = 128;
+    const std::uint8_t* const pixels = data.data() + static_cast<std::size_t>(y0) * w * bpp;
+    const int npixels = (y1 - y0) * w;
+    std::uint8_t* dst = out;
+    int curpix = 0;
     while (curpix < npixels) {
-        size_t chunkstart = curpix * bpp;
-        size_t curbyte = curpix * bpp;
-        std::uint8_t run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bpp; t++)
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bpp]);
-            curbyte += bpp;
-            if (1 == run_length)
-                raw = !succ_eq;
-            if (raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if (!raw && !succ_eq)
-                break;
-            run_length++;
+        const std::uint8_t* p = pixels + static_cast<std::size_t>(curpix) * bpp;
+        const int limit = std::min(max_chunk_length, npixels - curpix);
+        const int run = runLength(p, limit, bpp);
+        if (run > 1) {
+            *dst++ = static_cast<std::uint8_t>(run + 127);
+            std::memcpy(dst, p, bpp);
+            dst += bpp;
+            curpix += run;
+        } else {
+            const int raw = rawLength(p, limit, bpp);
+            *dst++ = static_cast<std::uint8_t>(raw - 1);
+            std::memcpy(dst, p, static_cast<std::size_t>(raw) * bpp);
+            dst += static_cast<std::size_t>(raw) * bpp;
+            curpix += raw;
         }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good())
-            return false;
-        out.write(reinterpret_cast<const char*>(data.data() + chunkstart), (raw ? run_length * bpp : bpp));
-        if (!out.good())
-            return false;
     }
-    return true;
+    return dst - out;
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
     if (!data.size() || x < 0 || y < 0 || x >= w || y >= h)
         return {};
     TGAColor ret = {0, 0, 0, 0, bpp};
-    const std::uint8_t* p = data.data() + (x + y * w) * bpp;
+    const std::uint8_t* p = data.data() + ((hflipped ? w - 1 - x : x) + (vflipped ? h - 1 - y : y) * w) * bpp;
     for (int i = bpp; i--; ret.bgra[i] = p[i])
         ;
     return ret;
@@ -189,21 +304,23 @@ TGAColor TGAImage::get(const int x, const int y) const {
 void TGAImage::set(int x, int y, const TGAColor& c) {
     if (!data.size() || x < 0 || y < 0 || x >= w || y >= h)
         return;
-    memcpy(data.data() + (x + y * w) * bpp, c.bgra, bpp);
+    memcpy(data.data() + ((hflipped ? w - 1 - x : x) + (vflipped ? h - 1 - y : y) * w) * bpp, c.bgra, bpp);
 }
 
 void TGAImage::flip_horizontally() {
-    for (int i = 0; i < w / 2; i++)
-        for (int j = 0; j < h; j++)
-            for (int b = 0; b < bpp; b++)
-                std::swap(data[(i + j * w) * bpp + b], data[(w - 1 - i + j * w) * bpp + b]);
+    hflipped = !hflipped;
 }
 
 void TGAImage::flip_vertically() {
-    for (int i = 0; i < w; i++)
-        for (int j = 0; j < h / 2; j++)
-            for (int b = 0; b < bpp; b++)
-                std::swap(data[(i + j * w) * bpp + b], data[(i + (h - 1 - j) * w) * bpp + b]);
+    vflipped = !vflipped;
+}
+
+bool TGAImage::is_flipped() const {
+    return vflipped || hflipped;
+}
+
+void TGAImage::clear() {
+    std::fill(data.begin(), data.end(), 0);
 }
 
 int TGAImage::width() const {
@@ -213,3 +330,15 @@ int TGAImage::width() const {
 int TGAImage::height() const {
     return h;
 }
+
+int TGAImage::bytespp() const {
+    return bpp;
+}
+
+std::uint8_t* TGAImage::buffer() {
+    return data.data();
+}
+
+const std::uint8_t* TGAImage::buffer() const {
+    return data.data();
+}
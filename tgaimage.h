@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
-#include <fstream>
+#include <span>
+#include <string>
 #include <vector>
 
 #pragma pack(push, 1)
@@ -36,17 +37,38 @@ struct TGAImage {
     TGAImage(const int w, const int h, const int bpp);
     bool read_tga_file(const std::string filename);
     bool write_tga_file(const std::string filename, const bool vflip = true, const bool rle = true) const;
+    // The same with the file encoded into buffer, whose capacity is reused, so writing a
+    // stream of frames allocates nothing once buffer has grown to fit them
+    bool write_tga_file(const std::string& filename, std::vector<std::uint8_t>& buffer, const bool vflip = true, const bool rle = true) const;
+    // Decodes a whole TGA file held in memory
+    bool decode_tga(std::span<const std::uint8_t> file);
+    // Encodes the image as a complete TGA file into out, replacing its contents but
+    // reusing its capacity, so frames can be shipped without touching the disk
+    bool encode_tga(std::vector<std::uint8_t>& out, const bool vflip = true, const bool rle = true) const;
+    // Images keep the row and column order they were loaded or written in and only
+    // record the orientation, so flipping is free and get()/set() address the flipped
+    // image. encode_tga() writes the pixels in stored order with a matching origin.
     void flip_horizontally();
     void flip_vertically();
+    // Whether the stored order differs from the image order, e.g. for a file with a
+    // bottom-left origin
+    bool is_flipped() const;
+    void clear();
     TGAColor get(const int x, const int y) const;
     void set(const int x, const int y, const TGAColor& c);
     int width() const;
     int height() const;
+    int bytespp() const;
+    // Pixels in stored order, width() * bytespp() bytes per row
+    std::uint8_t* buffer();
+    const std::uint8_t* buffer() const;
 
 private:
-    bool load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out) const;
+    bool decode_rle_data(std::span<const std::uint8_t> in);
+    std::size_t encode_rle_rows(const int y0, const int y1, std::uint8_t* out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
+    bool vflipped = false;
+    bool hflipped = false;
     std::vector<std::uint8_t> data = {};
 };
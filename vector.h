@@ -2,73 +2,82 @@
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <type_traits>
 
-template <int N>
+// Scalar type of the rendering pipeline: double, or float when built with
+// TINYRENDERER_FLOAT to double the SIMD width and halve the memory traffic
+#ifdef TINYRENDERER_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+
+template <int N, typename T = Real>
 struct Vector {
-    double data[N] = {0};
+    T data[N] = {0};
 
-    double& operator[](const int i) {
+    T& operator[](const int i) {
         assert(i >= 0 && i < N);
         return data[i];
     }
-    double operator[](const int i) const {
+    T operator[](const int i) const {
         assert(i >= 0 && i < N);
         return data[i];
     }
 };
 
-template <int N>
-double operator*(const Vector<N>& lhs, const Vector<N>& rhs) {
-    double ret = 0;
+template <int N, typename T>
+T operator*(const Vector<N, T>& lhs, const Vector<N, T>& rhs) {
+    T ret = 0;
     for (int i = 0; i < N; ++i) {
         ret += lhs[i] * rhs[i];
     }
     return ret;
 }
 
-template <int N>
-Vector<N> operator+(const Vector<N>& lhs, const Vector<N>& rhs) {
-    Vector<N> ret = lhs;
+template <int N, typename T>
+Vector<N, T> operator+(const Vector<N, T>& lhs, const Vector<N, T>& rhs) {
+    Vector<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] += rhs[i];
     }
     return ret;
 }
 
-template <int N>
-Vector<N> operator-(const Vector<N>& lhs, const Vector<N>& rhs) {
-    Vector<N> ret = lhs;
+template <int N, typename T>
+Vector<N, T> operator-(const Vector<N, T>& lhs, const Vector<N, T>& rhs) {
+    Vector<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] -= rhs[i];
     }
     return ret;
 }
 
-template <int N>
-Vector<N> operator*(const Vector<N>& lhs, const double& rhs) {
-    Vector<N> ret = lhs;
+template <int N, typename T>
+Vector<N, T> operator*(const Vector<N, T>& lhs, const std::type_identity_t<T>& rhs) {
+    Vector<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] *= rhs;
     }
     return ret;
 }
 
-template <int N>
-Vector<N> operator*(const double& lhs, const Vector<N>& rhs) {
+template <int N, typename T>
+Vector<N, T> operator*(const std::type_identity_t<T>& lhs, const Vector<N, T>& rhs) {
     return rhs * lhs;
 }
 
-template <int N>
-Vector<N> operator/(const Vector<N>& lhs, const double& rhs) {
-    Vector<N> ret = lhs;
+template <int N, typename T>
+Vector<N, T> operator/(const Vector<N, T>& lhs, const std::type_identity_t<T>& rhs) {
+    Vector<N, T> ret = lhs;
     for (int i = 0; i < N; ++i) {
         ret[i] /= rhs;
     }
     return ret;
 }
 
-template <int N>
-std::ostream& operator<<(std::ostream& out, const Vector<N>& v) {
+template <int N, typename T>
+std::ostream& operator<<(std::ostream& out, const Vector<N, T>& v) {
     for (int i = 0; i < N; ++i) {
         out << v[i] << " ";
     }
@@ -77,25 +86,25 @@ std::ostream& operator<<(std::ostream& out, const Vector<N>& v) {
 
 // Specializations for 2D, 3D, and 4D Vectors
 
-template <>
-struct Vector<2> {
-    double x = 0, y = 0;
+template <typename T>
+struct Vector<2, T> {
+    T x = 0, y = 0;
 
-    double& operator[](const int i) {
+    T& operator[](const int i) {
         assert(i >= 0 && i < 2);
         return i ? y : x;
     }
-    double operator[](const int i) const {
+    T operator[](const int i) const {
         assert(i >= 0 && i < 2);
         return i ? y : x;
     }
 };
 
-template <>
-struct Vector<3> {
-    double x = 0, y = 0, z = 0;
+template <typename T>
+struct Vector<3, T> {
+    T x = 0, y = 0, z = 0;
 
-    double& operator[](const int i) {
+    T& operator[](const int i) {
         assert(i >= 0 && i < 3);
         if (i == 0)
             return x;
@@ -103,7 +112,7 @@ struct Vector<3> {
             return y;
         return z;
     }
-    double operator[](const int i) const {
+    T operator[](const int i) const {
         assert(i >= 0 && i < 3);
         if (i == 0)
             return x;
@@ -113,11 +122,11 @@ struct Vector<3> {
     }
 };
 
-template <>
-struct Vector<4> {
-    double x = 0, y = 0, z = 0, w = 0;
+template <typename T>
+struct Vector<4, T> {
+    T x = 0, y = 0, z = 0, w = 0;
 
-    double& operator[](const int i) {
+    T& operator[](const int i) {
         assert(i >= 0 && i < 4);
         if (i == 0)
             return x;
@@ -127,7 +136,7 @@ struct Vector<4> {
             return z;
         return w;
     }
-    double operator[](const int i) const {
+    T operator[](const int i) const {
         assert(i >= 0 && i < 4);
         if (i == 0)
             return x;
@@ -137,10 +146,10 @@ struct Vector<4> {
             return z;
         return w;
     }
-    Vector<2> xy() const {
+    Vector<2, T> xy() const {
         return {x, y};
     }
-    Vector<3> xyz() const {
+    Vector<3, T> xyz() const {
         return {x, y, z};
     }
 };
@@ -149,17 +158,18 @@ typedef Vector<2> Vec2;
 typedef Vector<3> Vec3;
 typedef Vector<4> Vec4;
 
-template <int N>
-double norm(const Vector<N>& v) {
+template <int N, typename T>
+T norm(const Vector<N, T>& v) {
     return std::sqrt(v * v);
 }
 
-template <int N>
-Vector<N> normalized(const Vector<N>& v) {
+template <int N, typename T>
+Vector<N, T> normalized(const Vector<N, T>& v) {
     return v / norm(v);
 }
 
-inline Vec3 cross(const Vec3& v1, const Vec3& v2) {
+template <typename T>
+Vector<3, T> cross(const Vector<3, T>& v1, const Vector<3, T>& v2) {
     return {v1.y * v2.z - v1.z * v2.y,
             v1.z * v2.x - v1.x * v2.z,
             v1.x * v2.y - v1.y * v2.x};
@@ -0,0 +1,89 @@
+#include "zbuffer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+ZBuffer::ZBuffer(const int width, const int height)
+    : _width(width),
+      _height(height),
+      _blocks_x((width + BlockSize - 1) / BlockSize),
+      _blocks_y((height + BlockSize - 1) / BlockSize),
+      _tiles_x((width + TileSize - 1) / TileSize),
+      _tiles_y((height + TileSize - 1) / TileSize),
+      _depth(static_cast<std::size_t>(_blocks_x) * _blocks_y),
+      _blockMin(static_cast<std::size_t>(_blocks_x) * _blocks_y, Far),
+      _tileMin(static_cast<std::size_t>(_tiles_x) * _tiles_y, Far) {
+    clear();
+}
+
+void ZBuffer::clear() {
+    for (Block& block : _depth) {
+        std::fill(std::begin(block.depth), std::end(block.depth), Far);
+    }
+    std::fill(_blockMin.begin(), _blockMin.end(), Far);
+    std::fill(_tileMin.begin(), _tileMin.end(), Far);
+}
+
+int ZBuffer::width() const {
+    return _width;
+}
+
+int ZBuffer::height() const {
+    return _height;
+}
+
+const ZBuffer::Block& ZBuffer::block(const int bx, const int by) const {
+    return _depth[static_cast<std::size_t>(by) * _blocks_x + bx];
+}
+
+Real* ZBuffer::span(const int x, const int y) {
+    Block& block = _depth[static_cast<std::size_t>(y / BlockSize) * _blocks_x + x / BlockSize];
+    return block.depth + y % BlockSize * BlockSize + x % BlockSize;
+}
+
+const Real* ZBuffer::span(const int x, const int y) const {
+    return block(x / BlockSize, y / BlockSize).depth + y % BlockSize * BlockSize + x % BlockSize;
+}
+
+Real ZBuffer::get(const int x, const int y) const {
+    return block(x / BlockSize, y / BlockSize).depth[y % BlockSize * BlockSize + x % BlockSize];
+}
+
+Real ZBuffer::blockMin(const int bx, const int by) const {
+    return _blockMin[by * _blocks_x + bx];
+}
+
+Real ZBuffer::tileMin(const int tx, const int ty) const {
+    return _tileMin[ty * _tiles_x + tx];
+}
+
+void ZBuffer::updateBlock(const int bx, const int by) {
+    // Pixels of the blocks along the right and bottom edges beyond the buffer are never
+    // drawn, and must not keep the block from being rejected
+    const int w = std::min(BlockSize, _width - bx * BlockSize);
+    const int h = std::min(BlockSize, _height - by * BlockSize);
+    const Real* depth = block(bx, by).depth;
+    Real farthest = -Far;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            farthest = std::min(farthest, depth[y * BlockSize + x]);
+        }
+    }
+    _blockMin[by * _blocks_x + bx] = farthest;
+}
+
+void ZBuffer::updateTile(const int tx, const int ty) {
+    constexpr int blocks_per_tile = TileSize / BlockSize;
+    const int bx0 = tx * blocks_per_tile;
+    const int bx1 = std::min(bx0 + blocks_per_tile, _blocks_x);
+    const int by0 = ty * blocks_per_tile;
+    const int by1 = std::min(by0 + blocks_per_tile, _blocks_y);
+    Real farthest = -Far;
+    for (int by = by0; by < by1; ++by) {
+        for (int bx = bx0; bx < bx1; ++bx) {
+            farthest = std::min(farthest, blockMin(bx, by));
+        }
+    }
+    _tileMin[ty * _tiles_x + tx] = farthest;
+}
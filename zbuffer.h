@@ -0,0 +1,65 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "vector.h"
+
+#include <limits>
+#include <vector>
+
+// Side of the square screen tiles the binned rasterizer distributes across threads. A
+// tile row must fit in the 64-bit pixel masks returned by the span kernels.
+constexpr int TileSize = 64;
+static_assert(TileSize <= 64);
+
+// Depth buffer, larger values are closer to the camera. Besides the per-pixel depths it
+// keeps the farthest depth stored in every BlockSize x BlockSize block and in every
+// tile, so the rasterizer can reject geometry lying behind everything already drawn
+// there before doing any per-pixel work. Blocks and tiles never straddle each other,
+// so every level of the hierarchy is owned by the thread rasterizing the tile.
+//
+// The depths are stored block by block, each block contiguous and cache-line aligned
+// with its rows one after the other, so the rasterizer walking a block touches whole
+// cache lines that no other block shares.
+class ZBuffer {
+public:
+    static constexpr int BlockSize = 8;
+    static_assert(TileSize % BlockSize == 0);
+    static constexpr Real Far = -std::numeric_limits<Real>::max();
+
+    ZBuffer() = default;
+    ZBuffer(const int width, const int height);
+
+    // Resets every depth, and the hierarchy, to Far
+    void clear();
+    int width() const;
+    int height() const;
+    // Depth of pixel (x, y), followed by those of the pixels to its right up to the end
+    // of its block
+    Real* span(const int x, const int y);
+    const Real* span(const int x, const int y) const;
+    Real get(const int x, const int y) const;
+
+    // Farthest depth in block (bx, by), or in tile (tx, ty)
+    Real blockMin(const int bx, const int by) const;
+    Real tileMin(const int tx, const int ty) const;
+    // Refresh the hierarchy after depths of the block, or blocks of the tile, changed
+    void updateBlock(const int bx, const int by);
+    void updateTile(const int tx, const int ty);
+
+private:
+    struct alignas(CacheLineSize) Block {
+        Real depth[BlockSize * BlockSize];
+    };
+
+    const Block& block(const int bx, const int by) const;
+
+    int _width = 0;
+    int _height = 0;
+    int _blocks_x = 0;
+    int _blocks_y = 0;
+    int _tiles_x = 0;
+    int _tiles_y = 0;
+    std::vector<Block> _depth;
+    std::vector<Real> _blockMin;
+    std::vector<Real> _tileMin;
+};